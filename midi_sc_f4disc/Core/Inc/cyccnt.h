@@ -0,0 +1,48 @@
+/*
+* The MIT License (MIT)
+* Copyright (c) 2025 Ada Brzoza-Zajecka (Locriana)
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+* THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef INC_CYCCNT_H_
+#define INC_CYCCNT_H_
+
+#include "main.h"
+
+/*
+ * DWT cycle counter helpers for latency measurements
+ * at 168 MHz the counter wraps every ~25.5 s, so only differences
+ * of up to that long make sense (unsigned subtraction handles the wrap)
+ */
+
+static inline void cyccnt_init(void){
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+static inline uint32_t cyccnt_now(void){
+	return DWT->CYCCNT;
+}
+
+static inline uint32_t cyccnt_to_us(uint32_t cycles){
+	return cycles / (SystemCoreClock / 1000000U);
+}
+
+#endif /* INC_CYCCNT_H_ */
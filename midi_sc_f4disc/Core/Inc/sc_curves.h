@@ -12,12 +12,54 @@
 #include <sc_if.h>
 #include <inttypes.h>
 
-#define SC_CURVE_LEN    	16
-#define SC_CURVE_NAME_LEN	10
+#define SC_CURVE_LEN_MAX	32	//the longest curve, also the row size of the curve table
 
-#define SC_CURVE_NB     4
+/*
+ * the curve library: X(id, name, length, points)
+ * the points are either typed in or generated at build time by SC_CURVE_GEN
+ * from one of the shapes in sc_curves.c (see there)
+ * all the curves rise from 0 (full ducking) towards 127 (no effect)
+ * the presets refer to the curves by their position, so new ones go at the end
+ */
+#define SC_CURVE_LIBRARY(X) \
+	X(LINEAR,	"Linear",	16, SC_CURVE_POINTS_LINEAR) \
+	X(C2,		"C2",		16, SC_CURVE_POINTS_C2) \
+	X(C3,		"C3",		16, SC_CURVE_POINTS_C3) \
+	X(C4,		"C4",		16, SC_CURVE_POINTS_C4) \
+	SC_CURVE_FAMILY(X, 8) \
+	SC_CURVE_FAMILY(X, 16) \
+	SC_CURVE_FAMILY(X, 32)
+
+//the generated shapes, in every length
+#define SC_CURVE_FAMILY(X, len) \
+	X(EXP2_##len,	"Exp2/" #len,	len, SC_CURVE_GEN(SC_SHAPE_EXP, 2.0, len)) \
+	X(EXP4_##len,	"Exp4/" #len,	len, SC_CURVE_GEN(SC_SHAPE_EXP, 4.0, len)) \
+	X(LOG8_##len,	"Log8/" #len,	len, SC_CURVE_GEN(SC_SHAPE_LOG, 8.0, len)) \
+	X(LOG32_##len,	"Log32/" #len,	len, SC_CURVE_GEN(SC_SHAPE_LOG, 32.0, len)) \
+	X(S4_##len,		"S4/" #len,		len, SC_CURVE_GEN(SC_SHAPE_S, 4.0, len)) \
+	X(S8_##len,		"S8/" #len,		len, SC_CURVE_GEN(SC_SHAPE_S, 8.0, len)) \
+	X(POW2_##len,	"Pow2/" #len,	len, SC_CURVE_GEN(SC_SHAPE_POW, 2.0, len)) \
+	X(POW3_##len,	"Pow3/" #len,	len, SC_CURVE_GEN(SC_SHAPE_POW, 3.0, len)) \
+	X(SQRT_##len,	"Sqrt/" #len,	len, SC_CURVE_GEN(SC_SHAPE_POW, 0.5, len))
+
+#define SC_CURVE_X_ID(id, name, len, points)	SC_CURVE_##id,
+
+typedef enum {
+	SC_CURVE_LIBRARY(SC_CURVE_X_ID)
+	SC_CURVE_NB
+} sc_curve_id_t;
+
+extern const uint8_t sc_curve_points[SC_CURVE_NB][SC_CURVE_LEN_MAX];
+extern const uint8_t sc_curve_len[SC_CURVE_NB];
+
+static inline uint8_t sc_curve_get_item(uint8_t curveidx,uint8_t itemidx){
+	return sc_curve_points[curveidx][itemidx];
+}
+
+static inline uint8_t sc_curve_get_len(uint8_t curveidx){
+	return sc_curve_len[curveidx];
+}
 
-uint8_t sc_curve_get_item(uint8_t curveidx,uint8_t itemidx);
 const char* sc_curve_get_name(uint8_t idx);
 
 #endif /* INC_SC_CURVES_H_ */
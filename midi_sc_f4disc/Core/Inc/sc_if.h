@@ -28,10 +28,24 @@
 
 #define SC_PRESET_NB 16
 #define SC_PRESET_ALL  0xFF
+#define SC_PRESET_MASK_ALL	((uint32_t)((1ULL << SC_PRESET_NB) - 1))	//see sc_preset_changed
 
 #define SC_MAX_DEPTH		15
 
-#define SC_OUT_CH_NB		4
+#define SC_OUT_CH_NB		4		//a multiple of 4, the engine renders the destinations 4 at a time
+
+#define SC_DST_FOLLOW		(-1)	//a per-destination curve/depth/delay set to this follows the preset value
+
+#define SC_PRETRIG_UNIT_US	250		//pre-trigger lead resolution
+#define SC_PRETRIG_MAX		40		//...up to 10 ms
+
+#define SC_VEL_SENS_MAX		4		//velocity sensitivity: 0 = off...4 = the depth follows the velocity fully
+
+#define SC_XSRC_NB			2		//extra trigger sources (B, C) besides src_ch/src_note
+
+//how the envelopes of the voices playing at the same time are combined
+#define SC_COMBINE_MIN		0
+#define SC_COMBINE_PRODUCT	1
 
 
 typedef enum {
@@ -42,16 +56,22 @@ typedef enum {
 	SC_IDX_CURVE = 4,
 	SC_IDX_SRC_CH = 5,
 	SC_IDX_SRC_NOTE = 6,
+	//the per-destination values take SC_OUT_CH_NB consecutive indices each, A first
 	SC_IDX_DST_CH_A = 7,
-	SC_IDX_DST_CH_B = 8,
-	SC_IDX_DST_CH_C = 9,
-	SC_IDX_DST_CH_D = 10,
-	SC_IDX_DST_CC_A = 11,
-	SC_IDX_DST_CC_B = 12,
-	SC_IDX_DST_CC_C = 13,
-	SC_IDX_DST_CC_D = 14,
-	SC_IDX_DIRTY_SAVE = 15,
-	SC_IDX_NB = 16
+	SC_IDX_DST_CC_A = SC_IDX_DST_CH_A + SC_OUT_CH_NB,
+	SC_IDX_STEP_DIV = SC_IDX_DST_CC_A + SC_OUT_CH_NB,
+	SC_IDX_PRETRIG,
+	SC_IDX_XSRC_CH_B,
+	SC_IDX_XSRC_CH_C,
+	SC_IDX_XSRC_NOTE_B,
+	SC_IDX_XSRC_NOTE_C,
+	SC_IDX_COMBINE,
+	SC_IDX_DST_CURVE_A,
+	SC_IDX_DST_DEPTH_A = SC_IDX_DST_CURVE_A + SC_OUT_CH_NB,
+	SC_IDX_DST_DELAY_A = SC_IDX_DST_DEPTH_A + SC_OUT_CH_NB,
+	SC_IDX_VEL_SENS = SC_IDX_DST_DELAY_A + SC_OUT_CH_NB,
+	SC_IDX_DIRTY_SAVE,
+	SC_IDX_NB
 } sc_idx_t;
 
 #define SC_FIRST_EDITABLE_VALUE_IDX   1 //do not allow editing the PIDX "preset idx" value
@@ -69,6 +89,15 @@ typedef struct __attribute__((packed)){
 	sc_value_t src_note;
 	sc_value_t dst_ch[SC_OUT_CH_NB];
 	sc_value_t dst_cc[SC_OUT_CH_NB];
+	sc_value_t step_div;		//step length as a note value synced to the MIDI clock, 0 = off (step_delay is used)
+	sc_value_t pretrig;			//start the envelope this much before a predicted trigger note [SC_PRETRIG_UNIT_US], 0 = off
+	sc_value_t xsrc_ch[SC_XSRC_NB];		//more trigger sources, channel 0 = off
+	sc_value_t xsrc_note[SC_XSRC_NB];
+	sc_value_t combine;			//SC_COMBINE_MIN or SC_COMBINE_PRODUCT
+	sc_value_t dst_curve[SC_OUT_CH_NB];	//per-destination curve, depth and step delay [ms], SC_DST_FOLLOW = the preset's
+	sc_value_t dst_depth[SC_OUT_CH_NB];
+	sc_value_t dst_delay[SC_OUT_CH_NB];
+	sc_value_t vel_sens;		//how much the trigger velocity scales the depth, 0 = not at all
 	sc_value_t dirty_flag;
 }sc_preset_t;
 
@@ -77,11 +106,18 @@ void sc_init(void);
 
 //core interface
 sc_preset_t* sc_get_current_preset(void);
-int sc_preset_changed(void);
-
-//for midi interface
-void sc_input_note_on(uint8_t ch, uint8_t note, uint8_t velocity);
-void sc_cc_callback(uint8_t* chbuf, uint8_t *ccbuf, uint8_t value);
+const sc_preset_t* sc_get_preset(uint8_t pidx);
+uint32_t sc_presets_seq(void);	//for copying a preset consistently, see sc_if.c
+uint32_t sc_preset_changed(void);
+int sc_preset_selected(void);
+
+//for midi interface (rx_task; sc_input_set_value also from the UI, through sc_set_value / sc_change_value)
+void sc_input_note_on(uint8_t ch, uint8_t note, uint8_t velocity, uint32_t t_us);
+void sc_input_set_value(uint8_t pidx, sc_idx_t vidx, uint8_t v);
+void sc_input_clock(uint32_t t_us);
+void sc_input_program(uint8_t pidx);
+void sc_cc_callback(uint8_t* chbuf, uint8_t *ccbuf, uint8_t *values);
+void sc_route_callback(const sc_preset_t* preset);	//the inputs the engine listens to may have changed
 
 //value set/get
 sc_idx_t sc_get_current_vidx(void);
@@ -98,6 +134,7 @@ const char* sc_get_current_value_name(void);
 //preset select
 sc_preset_t* sc_change_preset(int change);
 sc_preset_t* sc_select_preset(uint8_t pidx);
+sc_preset_t* sc_program_change(uint8_t pidx);
 
 //preset management
 void sc_preset_fill_default(uint8_t idx);
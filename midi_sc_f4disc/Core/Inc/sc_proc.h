@@ -8,7 +8,20 @@
 #ifndef INC_SC_PROC_H_
 #define INC_SC_PROC_H_
 
+#define SC_RENDER_RATE_MAX_HZ	1000	//envelope render rate limit (and default), one value per millisecond
+
+//when a preset switch (program change) takes effect
+#define SC_SWITCH_AT_BOUNDARY	0		//after the running envelope
+#define SC_SWITCH_IMMEDIATE		1		//for the next note, the running envelope finishes as it is
+
 void sc_proc_core(void);
 void sc_proc_core_info_messages(uint8_t on);
+void sc_proc_print_stats(void);
+void sc_proc_reset_stats(void);
+void sc_proc_set_render_rate(uint32_t hz);
+uint32_t sc_proc_get_render_rate(void);
+void sc_proc_render_bench(void);
+void sc_proc_set_switch_policy(uint8_t policy);
+uint8_t sc_proc_get_switch_policy(void);
 
 #endif /* INC_SC_PROC_H_ */
@@ -0,0 +1,73 @@
+/*
+* The MIT License (MIT)
+* Copyright (c) 2025 Ada Brzoza-Zajecka (Locriana)
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+* THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef INC_SC_SCHED_H_
+#define INC_SC_SCHED_H_
+
+#include <inttypes.h>
+
+/*
+ * the unit of the envelope steps (step_delay) in microseconds
+ * the engine doesn't run on a tick: it sleeps until its next deadline or new input
+ */
+#define SC_SCHED_TICK_US        1000
+
+/*
+ * TIM1 counts at 1 MHz over its full 16-bit range; the update interrupt only
+ * extends the counter to the 32-bit microsecond timebase
+ */
+#define SC_SCHED_WRAP_US        65536
+
+/*
+ * a deadline is counted as "late" when the engine task starts
+ * processing it more than this many microseconds after it was due
+ */
+#define SC_SCHED_LATE_US        100
+
+typedef struct {
+  uint32_t wakeups;       //engine task runs...
+  uint32_t deadlines;     //...for a due timed event
+  uint32_t inputs;        //...for new input
+  uint32_t late;          //deadlines processed later than SC_SCHED_LATE_US
+  uint32_t latency_max;   //worst deadline wake-up latency [us]
+  uint32_t latency_last;  //most recent deadline wake-up latency [us]
+  uint32_t t_reset;       //when the stats were reset [us], for the wake-up rate
+} sc_sched_stats_t;
+
+int sc_sched_init(void);
+void sc_sched_start(void);
+void sc_sched_stop(void);
+
+//to be called from the TIM1 interrupts only: update (counter wrap) and compare channel 1
+void sc_sched_wrap_isr(void);
+void sc_sched_deadline_isr(void);
+//to be called from a task when there's new input for the engine
+void sc_sched_wake(void);
+
+//microsecond timebase for the timed events
+uint32_t sc_sched_now_us(void);
+
+void sc_sched_get_stats(sc_sched_stats_t* stats);
+void sc_sched_reset_stats(void);
+void sc_sched_print_stats(void);
+
+#endif /* INC_SC_SCHED_H_ */
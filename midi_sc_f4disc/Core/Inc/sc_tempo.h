@@ -0,0 +1,60 @@
+/*
+* The MIT License (MIT)
+* Copyright (c) 2025 Ada Brzoza-Zajecka (Locriana)
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+* THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef INC_SC_TEMPO_H_
+#define INC_SC_TEMPO_H_
+
+#include <inttypes.h>
+
+#define SC_TEMPO_PPQN			24		//MIDI clocks per quarter note
+#define SC_TEMPO_MIN_BPM		20
+#define SC_TEMPO_MAX_BPM		300
+#define SC_TEMPO_LOCK_CLOCKS	24		//clocks tracked before the estimate is used
+
+/*
+ * step divisions - the length of one envelope step as a note value
+ * index 0 means "off": the step delay in ms is used
+ */
+#define SC_TEMPO_DIV_NB			10
+
+typedef struct {
+	uint8_t locked;			//the estimate can be used
+	uint32_t clocks;		//clocks tracked since the last (re)lock
+	uint32_t period_q8;		//estimated clock period [us * 256]
+	uint32_t bpm_x100;		//estimated tempo [BPM * 100]
+	uint32_t jitter_us;		//mean absolute deviation of the clocks from the tracked phase
+	uint32_t jitter_max_us;	//the worst deviation since locked
+	uint32_t relocks;		//the clock was lost (stopped, out of range) and tracking started over
+} sc_tempo_t;
+
+//the tracker belongs to the engine: call these from the engine task only
+void sc_tempo_clock(uint32_t t_us);
+uint32_t sc_tempo_step_q8(uint8_t div);
+int sc_tempo_position_q8(uint32_t t_us, uint32_t* pos_q8);
+int sc_tempo_clock_time(uint32_t clock, uint32_t* t_us);
+
+//any task
+const char* sc_tempo_div_name(uint8_t div);
+void sc_tempo_get(sc_tempo_t* tempo);
+void sc_tempo_print(void);
+
+#endif /* INC_SC_TEMPO_H_ */
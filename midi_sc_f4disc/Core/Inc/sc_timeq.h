@@ -0,0 +1,65 @@
+/*
+* The MIT License (MIT)
+* Copyright (c) 2025 Ada Brzoza-Zajecka (Locriana)
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+* THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef INC_SC_TIMEQ_H_
+#define INC_SC_TIMEQ_H_
+
+#include <inttypes.h>
+
+/*
+ * timed event queue
+ * events are kept in a min-heap ordered by their due time (us, see sc_sched_now_us)
+ * and dispatched by the scheduler task; an event is just a function with an argument,
+ * so the queue can be used for anything that has to happen at a given time
+ * (envelope points, clock output...)
+ * events belong to an owner, so that all of them can be cancelled at once (retrigger)
+ * the scheduler sleeps until the earliest event it saw after its last run, so an event
+ * posted from another task has to be followed by sc_sched_wake()
+ */
+
+#define SC_TIMEQ_LEN			32
+
+//owners of the queued events
+#define SC_TIMEQ_OWNER_ENVELOPE	1
+#define SC_TIMEQ_OWNER_PRETRIG	2
+
+typedef void (*sc_timeq_fn_t)(uint32_t arg);
+
+typedef struct {
+	uint32_t posted;		//events accepted
+	uint32_t fired;			//events dispatched
+	uint32_t cancelled;		//events removed before they were due
+	uint32_t overflows;		//events rejected because the queue was full
+	uint32_t late_max;		//the worst dispatch delay after the due time [us]
+	uint16_t pending_max;	//the most events queued at once
+} sc_timeq_stats_t;
+
+int sc_timeq_post(uint8_t owner, uint32_t due_us, sc_timeq_fn_t fn, uint32_t arg);
+uint16_t sc_timeq_cancel(uint8_t owner);
+void sc_timeq_run(uint32_t now_us);
+int sc_timeq_next_due(uint32_t* due_us);
+
+void sc_timeq_get_stats(sc_timeq_stats_t* stats);
+void sc_timeq_reset_stats(void);
+void sc_timeq_print_stats(void);
+
+#endif /* INC_SC_TIMEQ_H_ */
@@ -53,6 +53,35 @@ typedef enum {
 
 #define usbmidi_PACKET_LENGTH		4
 
+typedef struct {
+	uint32_t frames;		//bulk IN transfers passed to rx_task
+	uint32_t packets;		//packets parsed by rx_task
+	uint32_t overflows;		//frames lost because all the rx frames were busy
+	uint32_t wait_max_us;	//the longest time a frame waited for rx_task
+	uint32_t filtered;		//packets dropped by the rx filter in the USB callback
+	uint32_t forwarded;		//packets let through to rx_task by the rx filter
+} usbmidi_rx_stats_t;
+
+typedef struct {
+	uint32_t packets;		//packets handed over to the USB stack
+	uint32_t transfers;		//bulk OUT transfers started
+	uint32_t done;			//packets confirmed by the TX complete callback
+	uint32_t dropped;		//packets dropped because the previous transfer never completed
+	uint32_t timed;			//transfers sent at the start of a given USB frame
+	uint32_t superseded;	//CCs dropped because a newer value for the same controller came before they were sent
+	uint32_t deduped;		//CCs skipped because the controller already had that value
+	uint32_t resynced;		//CCs sent again after a reconnection
+	uint32_t realtime;		//packets sent from the realtime lane
+	uint32_t bulk;			//packets sent from the bulk (SysEx) lane
+} usbmidi_tx_stats_t;
+
+typedef struct {
+	uint32_t count;			//note-on -> CC transfer completions measured
+	uint32_t last_us;
+	uint32_t sum_us;
+	uint32_t max_us;
+} usbmidi_lat_stats_t;
+
 /*
  * max supported length of the whole sysex message
  * defined for static buffer allocation
@@ -62,21 +91,44 @@ typedef enum {
 int usbmidi_init(void);
 void usbmidi_start(void);
 void usbmidi_set_cable(uint8_t p_cable);
+void usbmidi_class_active(void);	//call on HOST_USER_CLASS_ACTIVE
+
+/*
+ * rx handlers: msg holds the raw MIDI message (status byte first), len bytes long
+ * for SysEx it's the whole message including the 0xF0 & 0xF7
+ */
+typedef void (*usbmidi_rx_handler_t)(const uint8_t* msg, uint16_t len, void* ctx);
+
+//message classes for usbmidi_rx_subscribe, may be or-ed
+#define USBMIDI_RX_SYSCOMM			((1 << CIN_SYS_COMM_2B) | (1 << CIN_SYS_COMM_3B))	//including the single-byte ones
+#define USBMIDI_RX_SYSEX			(1 << CIN_SYSEX_ST_CNT)		//whole messages
+#define USBMIDI_RX_NOTE_OFF			(1 << CIN_NOTE_OFF)
+#define USBMIDI_RX_NOTE_ON			(1 << CIN_NOTE_ON)
+#define USBMIDI_RX_POLY_PRESSURE	(1 << CIN_POLY_KEYPRESS)
+#define USBMIDI_RX_CC				(1 << CIN_CC)
+#define USBMIDI_RX_PC				(1 << CIN_PC)
+#define USBMIDI_RX_CHAN_PRESSURE	(1 << CIN_CHAN_PRESSURE)
+#define USBMIDI_RX_PITCH_BEND		(1 << CIN_PITCH_BEND)
+#define USBMIDI_RX_BYTE				(1 << CIN_SINGLE_BYTE)		//single bytes, e.g. the realtime messages
+#define USBMIDI_RX_ALL				(USBMIDI_RX_SYSCOMM | USBMIDI_RX_SYSEX | 0xFF00)
 
-//callbacks
-void usbmidi_cb_note_on(uint8_t ch, uint8_t note, uint8_t velocity);
-void usbmidi_cb_note_off(uint8_t ch, uint8_t note, uint8_t velocity);
-void usbmidi_cb_syscomm(uint8_t status, uint8_t data1, uint8_t data2);	//raw format, channel is encoded in status
-void usbmidi_cb_pc(uint8_t ch, uint8_t program);						//program change
-void usbmidi_cb_cc(uint8_t ch, uint8_t ctrl, uint8_t value);			//control change rxed
-void usbmidi_cb_sysex(uint8_t* buf, uint16_t len);						//buf contains raw data, including the 0xF0 & 0xF7
-void usbmidi_cb_pitchbend(uint8_t ch, uint8_t data1, uint8_t data2);
-void usbmidi_cb_aftertouch(uint8_t ch, uint8_t data1, uint8_t data2);
-void usbmidi_cb_byte(uint8_t b);
+#define USBMIDI_RX_CH(msg)			(((msg)[0] & 0x0F) + 1)		//channel 1..16 of a channel message
+
+int usbmidi_rx_subscribe(uint16_t classes, usbmidi_rx_handler_t handler, void* ctx);
+void usbmidi_rx_unsubscribe(usbmidi_rx_handler_t handler, void* ctx);
+void usbmidi_rx_set_channels(usbmidi_rx_handler_t handler, void* ctx, uint16_t channels);	//also narrows the rx filter
+
+uint32_t usbmidi_cb_timestamp(void);	//the timebase for the rx timestamps [us]
+
+uint32_t usbmidi_rx_timestamp(void);	//arrival time of the packet being handled, for the rx handlers
 
 //transmit
 
 int usbmidi_tx_event(T_usbmidi_EVENT_PACKET* packet);
+int usbmidi_tx_events(T_usbmidi_EVENT_PACKET* packets, uint16_t nb);	//a batch which goes out in one bulk transfer
+int usbmidi_tx_events_at(T_usbmidi_EVENT_PACKET* packets, uint16_t nb, uint32_t frame);	//...at the start of the given USB frame
+uint32_t usbmidi_frame_now(void);	//the current USB frame (SOF) number
+int usbmidi_pack_cc(T_usbmidi_EVENT_PACKET* packet, uint8_t ch, uint8_t ctrl, uint8_t value);
 int usbmidi_tx_message(uint8_t status, uint8_t data1, uint8_t data2);
 int usbmidi_inject_to_midi_in(T_usbmidi_EVENT_PACKET* packet, uint16_t len);
 
@@ -87,6 +139,16 @@ void usbmidi_tx_pc(uint8_t ch, uint8_t program);						//program change
 void usbmidi_tx_cc(uint8_t ch, uint8_t ctrl, uint8_t value);			//control change rxed
 void usbmidi_tx_sysex(uint8_t* buf, uint16_t len);						//buf contains raw data and includes 0xF0 & 0xF7
 
+//statistics & testing
+void usbmidi_rx_get_stats(usbmidi_rx_stats_t* stats);
+void usbmidi_rx_print_stats(void);
+void usbmidi_rx_dispatch_bench(void);
+void usbmidi_tx_get_stats(usbmidi_tx_stats_t* stats);
+void usbmidi_tx_reset_stats(void);
+void usbmidi_tx_print_stats(void);
+void usbmidi_lat_get_stats(usbmidi_lat_stats_t* stats);	//note-in to CC-out latency, reset with usbmidi_tx_reset_stats()
+int usbmidi_tx_benchmark(uint16_t packets_nb, uint16_t max_batch);
+
 
 
 
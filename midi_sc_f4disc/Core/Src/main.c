@@ -30,6 +30,12 @@
 #include "lcd.h"
 #include "lcd_grid.h"
 #include "nvstore.h"
+#include "sc_sched.h"
+#include "sc_timeq.h"
+#include "sc_tempo.h"
+#include "sc_proc.h"
+#include "sc_curves.h"
+#include "cyccnt.h"
 #include "stm32f429i_discovery_ts.h"
 
 /* USER CODE END Includes */
@@ -41,6 +47,13 @@
 
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
+/*
+ * envelope steps are sent at the start of the USB frame this many frames after
+ * they were computed, so they land on exact frame boundaries;
+ * it has to cover the time needed to hand the batch over to the USB class
+ * 0 - send as soon as possible (not frame-aligned)
+ */
+#define SC_TX_LEAD_FRAMES	2
 
 /* USER CODE END PD */
 
@@ -93,6 +106,10 @@ static void MX_USART1_UART_Init(void);
 void StartDefaultTask(void *argument);
 
 /* USER CODE BEGIN PFP */
+static void rx_pc(const uint8_t* msg, uint16_t len, void* ctx);
+static void rx_cc(const uint8_t* msg, uint16_t len, void* ctx);
+static void rx_byte(const uint8_t* msg, uint16_t len, void* ctx);
+static void rx_note_on(const uint8_t* msg, uint16_t len, void* ctx);
 
 /* USER CODE END PFP */
 
@@ -141,6 +158,7 @@ int main(void)
   MX_USART1_UART_Init();
   /* USER CODE BEGIN 2 */
   debug_init(&huart1);
+  cyccnt_init();	//latency measurements
 
   xprintf("MIDI Sidechain\n");
   printf("printf test\n");
@@ -174,6 +192,11 @@ int main(void)
   /* USER CODE BEGIN RTOS_THREADS */
   /* add threads, ... */
   usbmidi_init();
+  usbmidi_rx_subscribe(USBMIDI_RX_NOTE_ON, rx_note_on, NULL);
+  usbmidi_rx_subscribe(USBMIDI_RX_CC, rx_cc, NULL);
+  usbmidi_rx_subscribe(USBMIDI_RX_PC, rx_pc, NULL);
+  usbmidi_rx_subscribe(USBMIDI_RX_BYTE, rx_byte, NULL);
+  sc_sched_init();
   /* USER CODE END RTOS_THREADS */
 
   /* USER CODE BEGIN RTOS_EVENTS */
@@ -471,7 +494,7 @@ static void MX_TIM1_Init(void)
 
   /* USER CODE END TIM1_Init 1 */
   htim1.Instance = TIM1;
-  htim1.Init.Prescaler = 0;
+  htim1.Init.Prescaler = 167;
   htim1.Init.CounterMode = TIM_COUNTERMODE_UP;
   htim1.Init.Period = 65535;
   htim1.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
@@ -750,18 +773,56 @@ void lcd_disp_value(int y){
   int x = LCD_X_SIZE/2;
   lcdSetFont(LCD_FONT_15);
   lcdSetTextCursor(x, y-1.2*lcdGetFontSize(lcdGetFont()));
-  switch(sc_get_current_vidx()){
+  sc_idx_t vidx = sc_get_current_vidx();
+  sc_value_t v = sc_get_current_value();
+  //the per-destination values come in ranges, one index per destination
+  if((vidx >= SC_IDX_DST_CH_A) && (vidx < SC_IDX_DST_CH_A + SC_OUT_CH_NB)){
+    vidx = SC_IDX_DST_CH_A;
+  }
+  else if((vidx >= SC_IDX_DST_CURVE_A) && (vidx < SC_IDX_DST_DELAY_A + SC_OUT_CH_NB)){
+    if(v == SC_DST_FOLLOW){
+      lcdCentered("   --    Preset    ++   ");
+      return;
+    }
+    if(vidx < SC_IDX_DST_DEPTH_A)
+      vidx = SC_IDX_CURVE;
+    else if(vidx >= SC_IDX_DST_DELAY_A){
+      lcdCentered("   --   %d ms   ++   ",v);
+      return;
+    }
+  }
+  switch(vidx){
     case SC_IDX_DIRTY_SAVE:
       lcdCentered("  Reload     Save  ");
       break;
     case SC_IDX_DST_CH_A:
-    case SC_IDX_DST_CH_B:
-    case SC_IDX_DST_CH_C:
-    case SC_IDX_DST_CH_D:
-      lcdCentered("   --    %s    ++   ",sc_get_channel_name(sc_get_current_value()));
+    case SC_IDX_XSRC_CH_B:
+    case SC_IDX_XSRC_CH_C:
+      lcdCentered("   --    %s    ++   ",sc_get_channel_name(v));
+      break;
+    case SC_IDX_STEP_DIV:
+      lcdCentered("   --    %s    ++   ",sc_tempo_div_name(v));
+      break;
+    case SC_IDX_CURVE:
+      lcdCentered("   --    %s    ++   ",sc_curve_get_name(v));
+      break;
+    case SC_IDX_COMBINE:
+      lcdCentered("   --    %s    ++   ",(v == SC_COMBINE_PRODUCT) ? "Product" : "Min");
+      break;
+    case SC_IDX_VEL_SENS:
+      if(v == 0)
+        lcdCentered("   --    Off    ++   ");
+      else
+        lcdCentered("   --   %d/%d   ++   ",v,SC_VEL_SENS_MAX);
+      break;
+    case SC_IDX_PRETRIG:
+      if(v == 0)
+        lcdCentered("   --    Off    ++   ");
+      else
+        lcdCentered("   --   %dus   ++   ",v * SC_PRETRIG_UNIT_US);
       break;
     default:
-      lcdCentered("   --     %d     ++   ",sc_get_current_value());
+      lcdCentered("   --     %d     ++   ",v);
       break;
   }
   //lcdSetFont(LCD_FONT_18);
@@ -876,6 +937,55 @@ void user_interface(void){
 		  break;
     case 'I':
       sc_proc_info_messages(1);
+      break;
+    case 't':
+      sc_sched_print_stats();
+      sc_timeq_print_stats();
+      break;
+    case 'T':
+      sc_sched_reset_stats();
+      sc_timeq_reset_stats();
+      xprintf("sc_sched & sc_timeq stats cleared\n");
+      break;
+    case 'm':
+      sc_tempo_print();
+      break;
+    case 'u':
+      usbmidi_rx_print_stats();
+      usbmidi_tx_print_stats();
+      break;
+    case 'U':
+      usbmidi_tx_reset_stats();
+      xprintf("usbmidi tx & latency stats cleared\n");
+      break;
+    case 'p':{
+      uint8_t policy = (sc_proc_get_switch_policy() == SC_SWITCH_IMMEDIATE) ? SC_SWITCH_AT_BOUNDARY : SC_SWITCH_IMMEDIATE;
+      sc_proc_set_switch_policy(policy);
+      xprintf("sc preset switch %s\n",(policy == SC_SWITCH_IMMEDIATE) ? "immediate" : "at envelope end");
+      break;
+    }
+    case 'r':
+      sc_proc_render_bench();
+      break;
+    case 'R':{
+      uint32_t rate = sc_proc_get_render_rate() / 2;	//1000, 500, 250, 125 Hz
+      if(rate < SC_RENDER_RATE_MAX_HZ / 8) rate = SC_RENDER_RATE_MAX_HZ;
+      sc_proc_set_render_rate(rate);
+      xprintf("sc render rate=%uHz\n",(unsigned int)sc_proc_get_render_rate());
+      break;
+    }
+    case 'b':{
+      xprintf("USB MIDI TX benchmark, one packet per transfer vs aggregated...\n");
+      int before = usbmidi_tx_benchmark(1000, 1);
+      int after = usbmidi_tx_benchmark(1000, 0xFFFF);
+      if( (before > 0) && (after > 0) ){
+        xprintf("usbmidi tx throughput: before (batch=1) %d packets/s, after (batch=max) %d packets/s, x%d.%02d\n",
+            before,after,after / before,(after % before) * 100 / before);
+      }
+      break;
+    }
+    case 'B':
+      usbmidi_rx_dispatch_bench();
       break;
 		case 'X':{
 			xprintf("erasing data...\n");
@@ -911,21 +1021,30 @@ void user_interface(void){
 
 }
 
-void usbmidi_cb_pc(uint8_t ch, uint8_t program){
+//MIDI input handlers, subscribed in main()
+static void rx_pc(const uint8_t* msg, uint16_t len, void* ctx){
+  uint8_t ch = USBMIDI_RX_CH(msg);
+  uint8_t program = msg[1];
   sc_preset_t* preset = sc_get_current_preset();
   if(ch == preset->src_ch){
     xprintf("Rx PC: Ch=%02d, Pr=%02d\n",ch,program);
-    sc_select_preset(program);
+    sc_program_change(program);	//no reload from flash, the engine switches in constant time
     update_rq = 1;
   }
 }
 
-void usbmidi_cb_cc(uint8_t ch, uint8_t ctrl, uint8_t value){
+static void rx_cc(const uint8_t* msg, uint16_t len, void* ctx){
+  uint8_t ch = USBMIDI_RX_CH(msg);
+  uint8_t ctrl = msg[1];
+  uint8_t value = msg[2];
   //using some officially "undefined" CCs according to:
   //https://midi.org/midi-1-0-control-change-messages
   #define CC_STEP_DELAY 20
   #define CC_DEPTH      21
   #define CC_CURVE      22
+  #define CC_STEP_DIV   23
+  #define CC_PRETRIG    24
+  #define CC_VEL_SENS   25
   sc_preset_t* preset = sc_get_current_preset();
   uint8_t pidx = sc_get_current_preset_idx();
   sc_idx_t current_value_idx = sc_get_current_vidx();
@@ -934,21 +1053,42 @@ void usbmidi_cb_cc(uint8_t ch, uint8_t ctrl, uint8_t value){
     switch(ctrl){
       case CC_DEPTH:
         value = value >> 3;
-        sc_set_value(pidx,SC_IDX_DEPTH, value);
+        sc_set_value(pidx,SC_IDX_DEPTH, value);	//the engine gets it through the input ring
         xprintf("Depth=%d\n",value);
         if(current_value_idx == SC_IDX_DEPTH)
           update_rq = 1;
         break;
       case CC_CURVE:
-        value = value >> 5;
-        sc_set_value(pidx,SC_IDX_CURVE, value);
-        xprintf("Curve=%d\n",value);
+        value = (value * SC_CURVE_NB) >> 7;
+        sc_set_value(pidx,SC_IDX_CURVE, value);	//the engine gets it through the input ring
+        xprintf("Curve=%s\n",sc_curve_get_name(value));
         if(current_value_idx == SC_IDX_CURVE)
           update_rq = 1;
         break;
+      case CC_STEP_DIV:
+        value = (value * SC_TEMPO_DIV_NB) >> 7;
+        sc_set_value(pidx,SC_IDX_STEP_DIV, value);	//the engine gets it through the input ring
+        xprintf("Step Sync=%s\n",sc_tempo_div_name(value));
+        if(current_value_idx == SC_IDX_STEP_DIV)
+          update_rq = 1;
+        break;
+      case CC_PRETRIG:
+        value = (value * (SC_PRETRIG_MAX + 1)) >> 7;
+        sc_set_value(pidx,SC_IDX_PRETRIG, value);	//the engine gets it through the input ring
+        xprintf("Pre-trigger=%dus\n",value * SC_PRETRIG_UNIT_US);
+        if(current_value_idx == SC_IDX_PRETRIG)
+          update_rq = 1;
+        break;
+      case CC_VEL_SENS:
+        value = (value * (SC_VEL_SENS_MAX + 1)) >> 7;
+        sc_set_value(pidx,SC_IDX_VEL_SENS, value);	//the engine gets it through the input ring
+        xprintf("Velocity Sens.=%d/%d\n",value,SC_VEL_SENS_MAX);
+        if(current_value_idx == SC_IDX_VEL_SENS)
+          update_rq = 1;
+        break;
       case CC_STEP_DELAY:
         value = value >> 1;
-        sc_set_value(pidx,SC_IDX_STEP_DELAY, value);
+        sc_set_value(pidx,SC_IDX_STEP_DELAY, value);	//the engine gets it through the input ring
         xprintf("Step Delay=%d\n",value);
         if(current_value_idx == SC_IDX_STEP_DELAY)
           update_rq = 1;
@@ -958,26 +1098,62 @@ void usbmidi_cb_cc(uint8_t ch, uint8_t ctrl, uint8_t value){
 }
 
 
-void usbmidi_cb_byte(uint8_t b){
+static void rx_byte(const uint8_t* msg, uint16_t len, void* ctx){
+	if(msg[0] == 0xF8){	//timing clock, for the tempo tracker
+		sc_input_clock(usbmidi_rx_timestamp());
+	}
 	LD3_TOGGLE;
 }
 
-void usbmidi_cb_note_on(uint8_t ch, uint8_t note, uint8_t velocity){
-	sc_input_note_on(ch, note, velocity);
+static void rx_note_on(const uint8_t* msg, uint16_t len, void* ctx){
+	sc_input_note_on(USBMIDI_RX_CH(msg), msg[1], msg[2], usbmidi_rx_timestamp());
 }
-
-void usbmidi_cb_note_off(uint8_t ch, uint8_t note, uint8_t velocity){
-	return;
+//rx timestamps in the same timebase as the engine
+uint32_t usbmidi_cb_timestamp(void){
+	return sc_sched_now_us();
 }
 
-void sc_cc_callback(uint8_t* chbuf, uint8_t *ccbuf, uint8_t value){
-	//usbmidi_tx_cc(chbuf[0], ccbuf[0], value);
+//all the destinations of one envelope step go out in a single USB transfer,
+//at the start of a USB frame; a destination with channel 0 is off or unchanged
+void sc_cc_callback(uint8_t* chbuf, uint8_t *ccbuf, uint8_t *values){
+	T_usbmidi_EVENT_PACKET packets[SC_OUT_CH_NB];
+	uint16_t packets_nb = 0;
 	for(int i=0;i<SC_OUT_CH_NB;i++){
 		if(chbuf[i]!=0){
-			usbmidi_tx_cc(chbuf[i], ccbuf[i], value);
-			vTaskDelay(2);
+			if(usbmidi_pack_cc(&packets[packets_nb], chbuf[i], ccbuf[i], values[i]) == 0){
+				packets_nb++;
+			}
 		}
 	}
+	if(packets_nb){
+#if SC_TX_LEAD_FRAMES
+		usbmidi_tx_events_at(packets, packets_nb, usbmidi_frame_now() + SC_TX_LEAD_FRAMES);
+#else
+		usbmidi_tx_events(packets, packets_nb);
+#endif
+	}
+}
+
+//the handlers above want notes from the trigger sources and CCs and PCs from src_ch only,
+//the USB input filter lets through just that (and the clock, the realtime bytes always pass)
+void sc_route_callback(const sc_preset_t* preset){
+	uint16_t src = ((preset->src_ch >= 1) && (preset->src_ch <= 16)) ? (1 << (preset->src_ch - 1)) : 0;
+	uint16_t notes = src;
+	for(int i=0;i<SC_XSRC_NB;i++){
+		if((preset->xsrc_ch[i] >= 1) && (preset->xsrc_ch[i] <= 16)){
+			notes |= 1 << (preset->xsrc_ch[i] - 1);
+		}
+	}
+	usbmidi_rx_set_channels(rx_cc, NULL, src);
+	usbmidi_rx_set_channels(rx_pc, NULL, src);
+	usbmidi_rx_set_channels(rx_note_on, NULL, notes);
+}
+
+//TIM1 compare: the engine's next deadline (see sc_sched.c)
+void HAL_TIM_OC_DelayElapsedCallback(TIM_HandleTypeDef *htim){
+  if(htim->Instance == TIM1){
+    sc_sched_deadline_isr();
+  }
 }
 
 extern void Touchscreen_Calibration(void);
@@ -1024,6 +1200,7 @@ void StartDefaultTask(void *argument)
   vTaskDelay(500);
   nv_init();
   sc_init();
+  sc_sched_start();
 
   //vTaskDelay(1000);
   xprintf("Touchscreen init...");
@@ -1047,12 +1224,10 @@ void StartDefaultTask(void *argument)
   lcd_draw_ui(1);
 
   /* Infinite loop */
+  //the sidechain engine runs from its own task now (see sc_sched.c)
   for(;;)
   {
-		for(int i=0;i<20;i++){
-	    sc_process();
-	    vTaskDelay(1);
-		}
+    vTaskDelay(20);
     user_interface();
   }
   /* USER CODE END 5 */
@@ -1076,7 +1251,10 @@ void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
     HAL_IncTick();
   }
   /* USER CODE BEGIN Callback 1 */
-
+  if (htim->Instance == TIM1)
+  {
+    sc_sched_wrap_isr();
+  }
   /* USER CODE END Callback 1 */
 }
 
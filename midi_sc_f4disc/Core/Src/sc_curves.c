@@ -7,92 +7,63 @@
 #include "main.h"
 #include "sc_curves.h"
 
+/*
+ * the typed-in curves (the original four), 127 after the last point like the generated ones
+ */
+#define SC_CURVE_PAD16			[16 ... SC_CURVE_LEN_MAX - 1] = 127
+#define SC_CURVE_POINTS_LINEAR	{0, 8, 16, 24, 32, 40, 48, 56, 64, 72, 80, 88, 96, 104, 112, 120, SC_CURVE_PAD16}
+#define SC_CURVE_POINTS_C2		{0, 12, 30, 60, 90, 105, 115, 120, 123, 125, 126, 127, 127, 127, 127, 127, SC_CURVE_PAD16}
+#define SC_CURVE_POINTS_C3		{0, 1, 3, 10, 18, 30, 50, 70, 90, 105, 118, 123, 125, 127, 127, 127, SC_CURVE_PAD16}
+#define SC_CURVE_POINTS_C4		{0, 24, 60, 85, 105, 115, 122, 125, 127, 127, 127, 127, 127, 127, 127, 127, SC_CURVE_PAD16}
 
-const char sc_curve_names[SC_CURVE_NB][SC_CURVE_LEN] = {
-    {"Linear"},
-    {"C2"},
-    {"C3"},
-    {"C4"}
-};
+/*
+ * the generated curves
+ * a shape is f(x) for x from 0 to 1, with f(0) = 0 and f(1) = 1, bent by the parameter k;
+ * GCC folds the math builtins of constant arguments, so the tables are computed
+ * by the compiler and nothing of this is left in the code
+ */
+#define SC_SHAPE_EXP(x, k)		((__builtin_exp((k) * (x)) - 1.0) / (__builtin_exp(k) - 1.0))	//slow start
+#define SC_SHAPE_LOG(x, k)		(__builtin_log(1.0 + (k) * (x)) / __builtin_log(1.0 + (k)))		//fast start
+#define SC_SHAPE_S(x, k)		(0.5 + 0.5 * __builtin_tanh((k) * ((x) - 0.5)) / __builtin_tanh(0.5 * (k)))
+#define SC_SHAPE_POW(x, k)		(__builtin_pow((x), (k)))
 
-const uint8_t sc_curve[SC_CURVE_NB][SC_CURVE_LEN] =
-{ {
-0	,
-8	,
-16	,
-24	,
-32	,
-40	,
-48	,
-56	,
-64	,
-72	,
-80	,
-88	,
-96	,
-104	,
-112	,
-120	},
+//point i of a curve of len points, 127 from the last point on
+#define SC_CURVE_POINT(shape, k, len, i) \
+	((i) >= (len) - 1 ? 127 : (uint8_t)(127.0 * shape((double)(i) / ((len) - 1), k) + 0.5))
 
-{
-0	,
-12	,
-30	,
-60	,
-90	,
-105	,
-115	,
-120	,
-123	,
-125	,
-126	,
-127	,
-127	,
-127	,
-127	,
-127	},
+#define SC_CURVE_GEN(shape, k, len) { \
+	SC_CURVE_POINT(shape, k, len, 0), SC_CURVE_POINT(shape, k, len, 1), SC_CURVE_POINT(shape, k, len, 2), SC_CURVE_POINT(shape, k, len, 3), \
+	SC_CURVE_POINT(shape, k, len, 4), SC_CURVE_POINT(shape, k, len, 5), SC_CURVE_POINT(shape, k, len, 6), SC_CURVE_POINT(shape, k, len, 7), \
+	SC_CURVE_POINT(shape, k, len, 8), SC_CURVE_POINT(shape, k, len, 9), SC_CURVE_POINT(shape, k, len, 10), SC_CURVE_POINT(shape, k, len, 11), \
+	SC_CURVE_POINT(shape, k, len, 12), SC_CURVE_POINT(shape, k, len, 13), SC_CURVE_POINT(shape, k, len, 14), SC_CURVE_POINT(shape, k, len, 15), \
+	SC_CURVE_POINT(shape, k, len, 16), SC_CURVE_POINT(shape, k, len, 17), SC_CURVE_POINT(shape, k, len, 18), SC_CURVE_POINT(shape, k, len, 19), \
+	SC_CURVE_POINT(shape, k, len, 20), SC_CURVE_POINT(shape, k, len, 21), SC_CURVE_POINT(shape, k, len, 22), SC_CURVE_POINT(shape, k, len, 23), \
+	SC_CURVE_POINT(shape, k, len, 24), SC_CURVE_POINT(shape, k, len, 25), SC_CURVE_POINT(shape, k, len, 26), SC_CURVE_POINT(shape, k, len, 27), \
+	SC_CURVE_POINT(shape, k, len, 28), SC_CURVE_POINT(shape, k, len, 29), SC_CURVE_POINT(shape, k, len, 30), SC_CURVE_POINT(shape, k, len, 31) \
+	}
 
-{
-0	,
-1	,
-3	,
-10	,
-18	,
-30	,
-50	,
-70	,
-90	,
-105	,
-118	,
-123	,
-125	,
-127	,
-127	,
-127	},
+#if SC_CURVE_LEN_MAX != 32
+#error "SC_CURVE_GEN lists the points of a SC_CURVE_LEN_MAX long row"
+#endif
 
-{
-0	,
-24	,
-60	,
-85	,
-105	,
-115	,
-122	,
-125	,
-127	,
-127	,
-127	,
-127	,
-127	,
-127	,
-127	,
-127	} };
+#define SC_CURVE_X_POINTS(id, name, len, points)	points,
+#define SC_CURVE_X_LEN(id, name, len, points)		len,
+#define SC_CURVE_X_NAME(id, name, len, points)		name,
 
-uint8_t sc_curve_get_item(uint8_t curveidx,uint8_t itemidx){
-	return sc_curve[curveidx][itemidx];
-}
+//one row per curve, the rows are SC_CURVE_LEN_MAX bytes, so the lookup is a shift and an add
+const uint8_t sc_curve_points[SC_CURVE_NB][SC_CURVE_LEN_MAX] __attribute__((aligned(SC_CURVE_LEN_MAX))) = {
+	SC_CURVE_LIBRARY(SC_CURVE_X_POINTS)
+};
+
+const uint8_t sc_curve_len[SC_CURVE_NB] = {
+	SC_CURVE_LIBRARY(SC_CURVE_X_LEN)
+};
+
+static const char* const sc_curve_names[SC_CURVE_NB] = {
+	SC_CURVE_LIBRARY(SC_CURVE_X_NAME)
+};
 
 const char* sc_curve_get_name(uint8_t idx){
-	return &sc_curve_names[idx][0];
+	if(idx >= SC_CURVE_NB) return "?";
+	return sc_curve_names[idx];
 }
-
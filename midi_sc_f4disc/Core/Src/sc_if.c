@@ -27,6 +27,9 @@
 #include <stdio.h>
 #include "dbgu.h"
 #include "sc_proc.h"
+#include "sc_tempo.h"
+#include "sc_curves.h"
+#include "sc_sched.h"
 
 #define SC_VALUES_NB		10
 #define SC_VALUES_NAME_LEN	10
@@ -52,11 +55,23 @@
 
 
 #define ITEM_NAME_LEN_MAX		30
-const char value_name[SC_IDX_NB][ITEM_NAME_LEN_MAX] = {
-		"    Preset Id    ","     Active     ","   Step Delay   ","   Depth   ","   Curve   ","   Source Channel   ","    Source Note    ",
-		" Dest. Channel A ", " Dest. Channel B ", " Dest. Channel C ", " Dest. Channel D ",
-		"   Dest. CC A   ", "   Dest. CC B   ", "  Dest. CC C  ", "  Dest. CC D  ",
-		"   Reload / Save  "
+//the per-destination names are filled in by value_names_init, one per destination
+static char value_name[SC_IDX_NB][ITEM_NAME_LEN_MAX] = {
+		[SC_IDX_PIDX] = "    Preset Id    ", [SC_IDX_ACTIVE] = "     Active     ", [SC_IDX_STEP_DELAY] = "   Step Delay   ",
+		[SC_IDX_DEPTH] = "   Depth   ", [SC_IDX_CURVE] = "   Curve   ", [SC_IDX_SRC_CH] = "   Source Channel   ",
+		[SC_IDX_SRC_NOTE] = "    Source Note    ",
+		[SC_IDX_STEP_DIV] = "   Step Sync   ", [SC_IDX_PRETRIG] = "   Pre-trigger   ",
+		[SC_IDX_XSRC_CH_B] = " Source B Channel ", [SC_IDX_XSRC_CH_C] = " Source C Channel ",
+		[SC_IDX_XSRC_NOTE_B] = "  Source B Note  ", [SC_IDX_XSRC_NOTE_C] = "  Source C Note  ", [SC_IDX_COMBINE] = "   Combine   ",
+		[SC_IDX_VEL_SENS] = "  Velocity Sens.  ", [SC_IDX_DIRTY_SAVE] = "   Reload / Save  "
+};
+static const struct {
+	sc_idx_t first;
+	const char* fmt;
+} value_name_dst[] = {
+		{SC_IDX_DST_CH_A, " Dest. Channel %c "}, {SC_IDX_DST_CC_A, "   Dest. CC %c   "},
+		{SC_IDX_DST_CURVE_A, "  Dest. Curve %c  "}, {SC_IDX_DST_DEPTH_A, "  Dest. Depth %c  "},
+		{SC_IDX_DST_DELAY_A, "  Dest. Delay %c  "}
 };
 
 
@@ -66,23 +81,53 @@ const char value_list_channels[17][5] = {
 	"Ch9","Ch10","Ch11","Ch12","Ch13","Ch14","Ch15","Ch16"
 };
 
-static int preset_changed = 0;
+static volatile uint32_t preset_changed = 0;	//one bit per preset
+static volatile int32_t preset_selected = -1;	//selected in the UI or loaded, for the engine; -1 = no request
 
+/*
+ * the UI's copy of the presets: edited, loaded and saved here, never read by the engine
+ * while it's being changed; the engine keeps copies of its own (see sc_proc.c):
+ * a single value goes to it through the input ring (sc_input_set_value), and after
+ * a rewrite of whole presets (load, defaults) it copies them, checking presets_seq
+ */
 static sc_preset_t presets[SC_PRESET_NB];
+static volatile uint32_t presets_seq = 0;	//odd while whole presets are being rewritten
 static uint8_t current_preset_idx = 0;
 static sc_idx_t current_value_idx = SC_FIRST_EDITABLE_VALUE_IDX;
-//                                       id, ac,dl,dp,cr,ch,nte,da,db,dc,dd, cca,  ccb,  ccc,               ccd,   dt
-static const sc_preset_t preset_v_min = { 0, 0, 1, 0,            0, 1,  0,{ 0, 0, 0, 0}, {0x01, 0x01, 0x01, 0x01}, 0};
-static const sc_preset_t preset_v_max = { 0, 1,63, SC_MAX_DEPTH, 3,16,127,{16,16,16,16}, {0x77, 0x77, 0x77, 0x77}, 1};
-static const sc_preset_t preset_v_def = { 0, 1, 5, 12,           0, 1, 36,{ 2, 0, 0, 0}, {0x07, 0x07, 0x07, 0x07}, 0};
+#define DST_ALL(v)	{[0 ... SC_OUT_CH_NB - 1] = (v)}
+static const sc_preset_t preset_v_min = {
+		.pidx = 0, .active = 0, .step_delay = 1, .depth = 0, .curve = 0, .src_ch = 1, .src_note = 0,
+		.dst_ch = DST_ALL(0), .dst_cc = DST_ALL(0x01),
+		.step_div = 0, .pretrig = 0, .xsrc_ch = {0, 0}, .xsrc_note = {0, 0}, .combine = SC_COMBINE_MIN,
+		.dst_curve = DST_ALL(SC_DST_FOLLOW), .dst_depth = DST_ALL(SC_DST_FOLLOW), .dst_delay = DST_ALL(SC_DST_FOLLOW),
+		.vel_sens = 0, .dirty_flag = 0
+};
+static const sc_preset_t preset_v_max = {
+		.pidx = 0, .active = 1, .step_delay = 63, .depth = SC_MAX_DEPTH, .curve = SC_CURVE_NB-1, .src_ch = 16, .src_note = 127,
+		.dst_ch = DST_ALL(16), .dst_cc = DST_ALL(0x77),
+		.step_div = SC_TEMPO_DIV_NB-1, .pretrig = SC_PRETRIG_MAX, .xsrc_ch = {16, 16}, .xsrc_note = {127, 127}, .combine = SC_COMBINE_PRODUCT,
+		.dst_curve = DST_ALL(SC_CURVE_NB-1), .dst_depth = DST_ALL(SC_MAX_DEPTH), .dst_delay = DST_ALL(63),
+		.vel_sens = SC_VEL_SENS_MAX, .dirty_flag = 1
+};
+static const sc_preset_t preset_v_def = {
+		.pidx = 0, .active = 1, .step_delay = 5, .depth = 12, .curve = 0, .src_ch = 1, .src_note = 36,
+		.dst_ch = {[0] = 2}, .dst_cc = DST_ALL(0x07),
+		.step_div = 0, .pretrig = 0, .xsrc_ch = {0, 0}, .xsrc_note = {38, 40}, .combine = SC_COMBINE_MIN,
+		.dst_curve = DST_ALL(SC_DST_FOLLOW), .dst_depth = DST_ALL(SC_DST_FOLLOW), .dst_delay = DST_ALL(SC_DST_FOLLOW),
+		.vel_sens = 0, .dirty_flag = 0
+};
 
+static void value_names_init(void);
 static int value_valid(uint8_t pidx, sc_idx_t vidx);
+static void mark_changed(uint8_t pidx);
 //sc_value_t set_value(uint8_t pidx, sc_idx_t vidx, sc_value_t v);
 static int check_all_presets(void)__attribute__((unused));
 static int check_preset(uint8_t pidx);
 static int any_dirty_flag(uint8_t pidx)__attribute__((unused));
 static void clear_dirty_flag(uint8_t pidx);
 static void set_dirty_flag(uint8_t pidx);
+static void presets_write_begin(void);
+static void presets_write_end(void);
 
 
 
@@ -90,6 +135,7 @@ void sc_init(void){
 	xprintf("sc_init\n");
 	PRINT_STATUS("F=INIT");
 	current_preset_idx = 0;
+	value_names_init();
 	sc_load_presets();
 	clear_dirty_flag(SC_PRESET_ALL);
 	for(uint8_t pidx = 0; pidx < SC_PRESET_NB; pidx++){
@@ -98,7 +144,7 @@ void sc_init(void){
 			set_dirty_flag(pidx);
 		}
 	}
-	preset_changed = 1;
+	mark_changed(SC_PRESET_ALL);
 
 
 /*	if(any_dirty_flag(SC_PRESET_ALL)){
@@ -117,9 +163,11 @@ void sc_proc_info_messages(uint8_t on){
 
 void sc_load_presets(void){
 	PRINT_STATUS("F=LOAD BSY=1");
+	presets_write_begin();
 	sc_cb_presets_load_from_nv(&presets[0],sizeof(presets));
+	presets_write_end();
 	PRINT_STATUS("F=LOAD BSY=0");
-	preset_changed = 1;
+	mark_changed(SC_PRESET_ALL);
 }
 
 static int preset_idx_valid(uint8_t idx){
@@ -166,11 +214,48 @@ sc_preset_t* sc_get_current_preset(void){
 	return &presets[current_preset_idx];
 }
 
-//preset needs to be re-processed
-int sc_preset_changed(void){
-	int res = preset_changed;
-	preset_changed = 0;
-	return res;
+const sc_preset_t* sc_get_preset(uint8_t pidx){
+	return &presets[pidx];
+}
+
+//whole presets are rewritten in between (UI task only)
+static void presets_write_begin(void){
+	presets_seq++;
+	__DMB();
+}
+
+static void presets_write_end(void){
+	__DMB();
+	presets_seq++;
+}
+
+/*
+ * for the engine's copy of a preset: the copy is good if the value is even
+ * and the same before and after it; otherwise it's dropped, the rewrite
+ * is followed by sc_preset_changed() anyway, so the preset gets copied again
+ */
+uint32_t sc_presets_seq(void){
+	return presets_seq;
+}
+
+//presets that need to be re-processed, one bit per preset
+//(read & clear in one go, a change made in the meantime by another task must not be lost)
+uint32_t sc_preset_changed(void){
+	return __atomic_exchange_n(&preset_changed, 0, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * the preset selected in the UI (or loaded) since the last call, -1 if none
+ * a program change doesn't go here, the engine gets it in order with the notes (sc_input_program)
+ */
+int sc_preset_selected(void){
+	return __atomic_exchange_n(&preset_selected, -1, __ATOMIC_SEQ_CST);
+}
+
+static void mark_changed(uint8_t pidx){
+	uint32_t mask = (pidx == SC_PRESET_ALL) ? SC_PRESET_MASK_ALL : (1UL << pidx);
+	__atomic_fetch_or(&preset_changed, mask, __ATOMIC_SEQ_CST);
+	sc_sched_wake();	//the engine picks the change up (see sc_preset_changed)
 }
 
 static void sc_status_preset(uint8_t pidx){
@@ -206,14 +291,19 @@ void sc_disp_preset(uint8_t pidx){
 	xprintf(" * pidx = %d\n",presets[pidx].pidx);
 	xprintf(" * actv = %d\n",presets[pidx].active);
 	xprintf(" * stpd = %d\n",presets[pidx].step_delay);
-	xprintf(" * curv = %d\n",presets[pidx].curve);
+	xprintf(" * curv = %d (%s)\n",presets[pidx].curve,sc_curve_get_name(presets[pidx].curve));
 	xprintf(" * dpth = %d\n",presets[pidx].depth);
 	xprintf(" * srch = %d\n",presets[pidx].src_ch);
 	xprintf(" * srnt = %d\n",presets[pidx].src_note);
-	for(int i=0;i<4;i++)
-		xprintf(" * dch%d = %d\n",i,presets[pidx].dst_ch[i]);
-	for(int i=0;i<4;i++)
-		xprintf(" * dCC%d = %d\n",i,presets[pidx].dst_cc[i]);
+	for(int i=0;i<SC_XSRC_NB;i++)
+		xprintf(" * xch%d = %d, xnt%d = %d\n",i,presets[pidx].xsrc_ch[i],i,presets[pidx].xsrc_note[i]);
+	for(int i=0;i<SC_OUT_CH_NB;i++)
+		xprintf(" * dch%d = %d, dCC%d = %d, dcrv%d = %d, ddpt%d = %d, ddly%d = %d\n",i,presets[pidx].dst_ch[i],i,presets[pidx].dst_cc[i],
+				i,presets[pidx].dst_curve[i],i,presets[pidx].dst_depth[i],i,presets[pidx].dst_delay[i]);
+	xprintf(" * sdiv = %d (%s)\n",presets[pidx].step_div,sc_tempo_div_name(presets[pidx].step_div));
+	xprintf(" * ptrg = %d (%dus)\n",presets[pidx].pretrig,presets[pidx].pretrig * SC_PRETRIG_UNIT_US);
+	xprintf(" * cmb  = %d\n",presets[pidx].combine);
+	xprintf(" * vsns = %d\n",presets[pidx].vel_sens);
 	xprintf(" * drty = %d\n",presets[pidx].dirty_flag);
 }
 
@@ -243,6 +333,14 @@ const char* sc_get_current_value_name(void){
 	return value_name[current_value_idx];
 }
 
+static void value_names_init(void){
+	for(unsigned g = 0; g < sizeof(value_name_dst) / sizeof(value_name_dst[0]); g++){
+		for(int i = 0; i < SC_OUT_CH_NB; i++){
+			snprintf(value_name[value_name_dst[g].first + i], ITEM_NAME_LEN_MAX, value_name_dst[g].fmt, 'A' + i);
+		}
+	}
+}
+
 static int check_preset(uint8_t pidx){
 	PRINT_DBG("check_preset %d...\n",pidx);
 	int res = 1;
@@ -277,11 +375,26 @@ sc_preset_t* sc_select_preset(uint8_t pidx){
   if(pidx < SC_PRESET_NB){
     current_preset_idx = pidx;
   }
+  __atomic_store_n(&preset_selected, current_preset_idx, __ATOMIC_SEQ_CST);
   sc_load_presets();
   clear_dirty_flag(SC_PRESET_ALL);
   PRINT_STATUS("F=SELPRES CPIDX=%d CVIDX=%d",current_preset_idx,current_value_idx);
   PRINT_DBG("sc_select_preset ends, curr pidx=%d, ret addr = %08X\n",current_preset_idx,(unsigned int)&presets[current_preset_idx]);
-  preset_changed = 1;
+  return &presets[current_preset_idx];
+}
+
+/*
+ * program change: makes pidx the current preset as it is, without reloading
+ * the presets from flash (unsaved edits stay); rx_task only
+ * the engine switches to the render data it already has for the preset,
+ * in order with the notes around the program change (see sc_input_program)
+ */
+sc_preset_t* sc_program_change(uint8_t pidx){
+  if(pidx < SC_PRESET_NB){
+    current_preset_idx = pidx;
+    sc_input_program(pidx);
+  }
+  PRINT_STATUS("F=SELPRES CPIDX=%d CVIDX=%d",current_preset_idx,current_value_idx);
   return &presets[current_preset_idx];
 }
 
@@ -385,7 +498,7 @@ sc_value_t sc_change_value(sc_idx_t vidx, int mod){
 		}
 		set_dirty_flag(current_preset_idx);
 		PRINT_STATUS("F=CHGVAL PIDX=%d VIDX=%d VNAME=%s VAL=%d",current_preset_idx,vidx,value_name[vidx],preset_buf[vidx]);
-		preset_changed = 1;
+		sc_input_set_value(current_preset_idx, vidx, preset_buf[vidx]);	//the engine applies it to its own copy
 		return preset_buf[vidx];
 	}
 }
@@ -416,7 +529,7 @@ sc_value_t sc_set_value(uint8_t pidx, sc_idx_t vidx, uint8_t v){
   }
   set_dirty_flag(current_preset_idx);
   PRINT_STATUS("F=SETVAL PIDX=%d VIDX=%d VNAME=%s VAL=%d",current_preset_idx,vidx,value_name[vidx],preset_buf[vidx]);
-  preset_changed = 1;
+  sc_input_set_value(pidx, vidx, preset_buf[vidx]);	//the engine applies it to its own copy
   return preset_buf[vidx];
 }
 
@@ -427,6 +540,7 @@ void sc_preset_fill_default(uint8_t pidx){
 	if(!preset_idx_valid(pidx)){xprintf("sc_preset_load_default: pidx out of range\n"); return;}
 	PRINT_STATUS("F=FILLDEF");
 
+	presets_write_begin();
 	if(pidx==SC_PRESET_ALL){
 		for(uint8_t i=0;i<SC_PRESET_NB;i++){
 			memcpy(&presets[i],&preset_v_def,sizeof(sc_preset_t));
@@ -439,7 +553,8 @@ void sc_preset_fill_default(uint8_t pidx){
 		presets[pidx].pidx = pidx;
 		set_dirty_flag(pidx);
 	}
-	preset_changed = 1;
+	presets_write_end();
+	mark_changed(pidx);
 }
 
 static void set_dirty_flag(uint8_t pidx){
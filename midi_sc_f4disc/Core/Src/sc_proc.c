@@ -22,10 +22,17 @@
 
 #include "sc_if.h"
 #include "main.h"
+#include "FreeRTOS.h"
+#include "task.h"
 #include <string.h>
 #include <stdio.h>
 #include "dbgu.h"
 #include "sc_curves.h"
+#include "sc_sched.h"
+#include "sc_timeq.h"
+#include "sc_tempo.h"
+#include "sc_proc.h"
+#include "cyccnt.h"
 
 
 #define PRINT_DBG_ON		0
@@ -38,42 +45,420 @@
 
 static uint8_t print_info = 0;
 
-static uint8_t cc_buf[4] = {7,7,7,7};
-static uint8_t ch_buf[4] = {2,3,4,5};
-static sc_preset_t *preset;
-static uint8_t current_curve[SC_CURVE_LEN];
+/*
+ * the engine state below is owned by the scheduler task (sc_proc_core and the envelope events);
+ * the MIDI input doesn't touch it, it sends timestamped messages through the input ring instead
+ *
+ * render cache: the engine keeps its own copy of every preset together with what
+ * the envelope needs from it; an entry is rebuilt only when its preset is loaded or
+ * edited (sc_preset_changed), so a preset switch is just a pointer swap
+ *
+ * the destinations are kept as arrays, one byte per destination, so that the arithmetic
+ * (depth offset, clamp, min combine) and the change detection run on 4 of them at once
+ * with the SIMD instructions (see the lanes below); the destinations sharing a curve and
+ * a step share a shape, which is interpolated only once per render
+ * what stays per destination: spreading the shape values to the destinations (a byte gather,
+ * there's no SIMD for it), the velocity lookup at voice start, the product combine;
+ * so a render costs shapes * interpolation + SC_OUT_CH_NB gathers + SC_OUT_CH_NB/4 words
+ */
+#if (SC_OUT_CH_NB % 4) != 0
+#error "SC_OUT_CH_NB must be a multiple of 4"
+#endif
+
+#define SC_OUT_WORDS	(SC_OUT_CH_NB / 4)
+#define SC_SHAPE_FLAT	SC_OUT_CH_NB		//the shape of a destination that doesn't move (off, depth 0)
+#define SC_LANE_NONE	0xFF
+
+typedef union {
+	uint8_t u8[SC_OUT_CH_NB];
+	uint32_t u32[SC_OUT_WORDS];
+} sc_lanes_t;
+
+typedef struct {
+	sc_preset_t preset;
+	uint8_t ch[SC_OUT_CH_NB];
+	uint8_t cc[SC_OUT_CH_NB];
+	uint8_t depth[SC_OUT_CH_NB];		//per destination, 0 = it doesn't move
+	const uint8_t (*vel_mod)[SC_MAX_DEPTH + 1];	//the depth offsets by velocity and depth (see vel_lut_get)
+	uint8_t shape_of[SC_OUT_CH_NB];		//per destination: the shape it plays, or SC_SHAPE_FLAT
+	uint8_t shape_nb;
+	uint8_t shape_curve[SC_OUT_CH_NB];
+	int8_t shape_delay[SC_OUT_CH_NB];	//step_delay or SC_DST_FOLLOW (the preset step, tempo sync included)
+	uint8_t shape_knot_nb[SC_OUT_CH_NB];
+	uint32_t shape_inv_step[SC_OUT_CH_NB];	//2^40 / step, 0 = synced to the tempo, so known only at the trigger
+	uint8_t shape_knots[SC_OUT_CH_NB][SC_CURVE_LEN_MAX + 1];	//the curve ending with the 127 restore
+	sc_lanes_t out_last;	//the last values sent to the destinations...
+	uint8_t out_valid;		//...if known
+} sc_render_t;
+
+static sc_render_t render_cache[SC_PRESET_NB];
+static uint32_t render_gen = 0;		//changes whenever an entry is rebuilt
+static sc_render_t* render = &render_cache[0];		//the current preset
+static sc_render_t* render_next = NULL;			//the switch waiting for the envelope to end
+static const sc_preset_t* preset = &render_cache[0].preset;
+static volatile uint8_t switch_policy = SC_SWITCH_AT_BOUNDARY;
+
+static struct {
+	uint32_t switches;		//preset switches done
+	uint32_t deferred;		//...of them waited for the running envelope
+	uint32_t rebuilds;		//render cache entries computed
+	uint32_t torn;			//preset copies dropped, the preset was being rewritten
+} cache_stats;
+
+/*
+ * input ring: producers rx_task and the UI (sc_input_set_value via sc_set_value / sc_change_value),
+ * serialized by a short critical section, lock-free single consumer (scheduler task)
+ * the producers only write ring_head, the consumer only writes ring_tail
+ */
+#define SC_RING_LEN			32		//must be a power of 2
+
+typedef enum {
+	SC_MSG_NOTE_ON = 0,
+	SC_MSG_SET_VALUE,
+	SC_MSG_CLOCK,
+	SC_MSG_PROGRAM
+} sc_msg_type_t;
+
+typedef struct {
+	uint32_t t_us;		//note on, clock: arrival time, set value: when it was produced (sc_sched_now_us timebase)
+	uint8_t type;		//sc_msg_type_t
+	uint8_t d[3];		//note on: ch, note, velocity; set value: pidx, vidx, value; program: pidx
+} sc_msg_t;
+
+static sc_msg_t ring[SC_RING_LEN];
+static volatile uint32_t ring_head = 0;
+static volatile uint32_t ring_tail = 0;
+static volatile uint32_t ring_overflows = 0;
+static uint32_t trig_age_last = 0;	//from the note arrival to the engine [us]
+static uint32_t trig_age_max = 0;
+
+/*
+ * envelope rendering
+ * the curve points (knots) are a step apart; the envelope holds the first
+ * one for a step, then goes through the rest with Q16 linear interpolation between them
+ * and ends at the first 127
+ * it's rendered at render_rate_hz, and a CC goes out only when the 7-bit value changes
+ * the position [knots * 2^16] = (t - t0) * inv_step >> 16, inv_step = 2^40 / step [us * 256]
+ */
+
+/*
+ * voices: every trigger starts an envelope in a voice of a fixed pool, so the envelopes
+ * of different trigger sources (or a retriggered one) can overlap; all the voices are
+ * computed together at each render period and the ones playing on the same preset
+ * are combined into one stream of values for its destinations (see mix)
+ */
+#define SC_VOICE_NB		8
 
-static int state = 0xFF;
-static volatile int step_delay_cntr=0;
+typedef struct {
+	uint32_t t0;			//the envelope start [us]
+	uint32_t inv_step[SC_OUT_CH_NB];	//per shape
+	sc_lanes_t mod;			//per destination: the depth at the trigger velocity as an offset added to the shape
+	uint8_t velocity;
+	const sc_render_t* shapes;	//the preset the envelope was started with (shapes, depths)
+	sc_render_t* render;	//the preset the voice plays on (destinations, combine mode)
+	uint8_t lane_of[SC_OUT_CH_NB];	//if they differ: the shapes destination played on each destination of render
+	uint32_t gen;			//render_gen when the steps and lane_of were computed
+	uint32_t id;			//tells a restarted voice from the one that was there before
+	uint8_t src;			//trigger source: 0 = src_ch/src_note, 1.. = xsrc
+	uint8_t active;
+} sc_voice_t;
 
-static void mod_curve(){
-	int mod = 0;
-	if(preset->depth > 0){
-	  mod = (SC_MAX_DEPTH + 1 - preset->depth) * 8;
+static sc_voice_t voices[SC_VOICE_NB];
+static uint8_t voices_active = 0;
+static uint32_t voice_ids = 0;
+static uint8_t mix_running = 0;
+static uint32_t mix_next;			//due time of the next mix
+static volatile uint32_t render_rate_hz = SC_RENDER_RATE_MAX_HZ;
+
+static struct {
+	uint32_t started;
+	uint32_t stolen;		//started in a voice that was still playing (the pool was full)
+	uint8_t active_max;
+} voice_stats;
+
+static struct {
+	uint32_t renders;		//voices computed
+	uint32_t sent;			//destination values that changed, so they were sent
+	uint32_t cycles_sum;	//render cost, without sending
+	uint32_t cycles_max;
+} render_stats;
+
+/*
+ * 4 destinations at once: unsigned saturating add and minimum of the bytes
+ */
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+static inline uint32_t lanes4_add(uint32_t a, uint32_t b){
+	return __UQADD8(a, b);
+}
+
+static inline uint32_t lanes4_min(uint32_t a, uint32_t b){
+	__USUB8(a, b);			//GE set where a >= b...
+	return __SEL(b, a);		//...and b picked there
+}
+#else
+static inline uint32_t lanes4_add(uint32_t a, uint32_t b){
+	uint32_t r = 0;
+	for(int i=0;i<32;i+=8){
+		uint32_t x = ((a >> i) & 0xFF) + ((b >> i) & 0xFF);
+		r |= ((x > 0xFF) ? 0xFF : x) << i;
 	}
-	else{
-	  mod = 127;
+	return r;
+}
+
+static inline uint32_t lanes4_min(uint32_t a, uint32_t b){
+	uint32_t r = 0;
+	for(int i=0;i<32;i+=8){
+		uint32_t x = (a >> i) & 0xFF, y = (b >> i) & 0xFF;
+		r |= ((x < y) ? x : y) << i;
 	}
-	//PRINT_DBG("sc core proc mod=%02X",mod);
-	for(int i=0;i<SC_CURVE_LEN;i++){
+	return r;
+}
+#endif
+
+#define LANES4_127		0x7F7F7F7FUL
 
-		int temp = sc_curve_get_item(preset->curve,i);
-		temp = temp + mod;
-		if(temp > 127) temp = 127;
-		current_curve[i] = (uint8_t)temp;
+//0xFF in every byte of x that isn't 0, 0x00 elsewhere
+static inline uint32_t lanes4_nonzero(uint32_t x){
+	uint32_t t = (((x & 0x7F7F7F7FUL) + 0x7F7F7F7FUL) | x) & 0x80808080UL;
+	return (t >> 7) * 0xFF;
+}
+
+static inline uint32_t lanes4_load(const uint8_t* p){
+	uint32_t x;
+	memcpy(&x, p, sizeof(x));
+	return x;
+}
+
+/*
+ * the curve always ends with 127: the first 127 in it or the restore added after the last point
+ * returns the number of knots
+ */
+static uint8_t build_knots(uint8_t curve, uint8_t* knots){
+	uint8_t len = sc_curve_get_len(curve);
+	for(int i=0;i<len;i++){
+		knots[i] = sc_curve_get_item(curve,i);
+		if(knots[i] >= 127) return i + 1;
+	}
+	knots[len] = 127;
+	return len + 1;
+}
+
+//the depth as the offset added to the curve, 127 mutes the destination
+static uint8_t depth_mod(int depth, int active){
+	if( (depth > 0) && active ){
+		return (SC_MAX_DEPTH + 1 - depth) * 8;
+	}
+	return 127;
+}
+
+/*
+ * velocity sensitivity: the depth offsets for every velocity and depth, one table per
+ * sensitivity setting; a trigger then only looks its depths up, with no multiply or divide
+ * the depth is scaled by 1 - sens / SC_VEL_SENS_MAX * (127 - velocity) / 127 and rounded;
+ * the tables are computed by the compiler (the same formula as depth_mod), so they're const
+ * and live in flash instead of RAM
+ */
+#if SC_MAX_DEPTH != 15
+#error "VEL_LUT_ROW expects SC_MAX_DEPTH == 15"
+#endif
+#define VEL_LUT_FULL		(127 * SC_VEL_SENS_MAX)
+#define VEL_LUT_MOD(d)		(((d) > 0) ? (SC_MAX_DEPTH + 1 - (d)) * 8 : 127)
+#define VEL_LUT(s, v, d)	VEL_LUT_MOD(((d) * (VEL_LUT_FULL - (s) * (127 - (v))) + VEL_LUT_FULL / 2) / VEL_LUT_FULL)
+#define VEL_LUT_ROW(s, v)	{VEL_LUT(s, v, 0), VEL_LUT(s, v, 1), VEL_LUT(s, v, 2), VEL_LUT(s, v, 3), \
+							VEL_LUT(s, v, 4), VEL_LUT(s, v, 5), VEL_LUT(s, v, 6), VEL_LUT(s, v, 7), \
+							VEL_LUT(s, v, 8), VEL_LUT(s, v, 9), VEL_LUT(s, v, 10), VEL_LUT(s, v, 11), \
+							VEL_LUT(s, v, 12), VEL_LUT(s, v, 13), VEL_LUT(s, v, 14), VEL_LUT(s, v, 15)}
+#define VEL_LUT_ROWS4(s, v)		VEL_LUT_ROW(s, v), VEL_LUT_ROW(s, (v) + 1), VEL_LUT_ROW(s, (v) + 2), VEL_LUT_ROW(s, (v) + 3)
+#define VEL_LUT_ROWS16(s, v)	VEL_LUT_ROWS4(s, v), VEL_LUT_ROWS4(s, (v) + 4), VEL_LUT_ROWS4(s, (v) + 8), VEL_LUT_ROWS4(s, (v) + 12)
+#define VEL_LUT_ROWS64(s, v)	VEL_LUT_ROWS16(s, v), VEL_LUT_ROWS16(s, (v) + 16), VEL_LUT_ROWS16(s, (v) + 32), VEL_LUT_ROWS16(s, (v) + 48)
+#define VEL_LUT_TABLE(s)		{VEL_LUT_ROWS64(s, 0), VEL_LUT_ROWS64(s, 64)}
+
+static const uint8_t vel_lut[SC_VEL_SENS_MAX + 1][128][SC_MAX_DEPTH + 1] = {
+		VEL_LUT_TABLE(0), VEL_LUT_TABLE(1), VEL_LUT_TABLE(2), VEL_LUT_TABLE(3), VEL_LUT_TABLE(4)
+};
+_Static_assert(SC_VEL_SENS_MAX == 4, "vel_lut has a table for sensitivities 0..4");
+
+static const uint8_t (*vel_lut_get(int sens))[SC_MAX_DEPTH + 1]{
+	if(sens < 0) sens = 0;
+	if(sens > SC_VEL_SENS_MAX) sens = SC_VEL_SENS_MAX;
+	return vel_lut[sens];
+}
+
+static uint32_t env_pos(uint32_t t0, uint32_t inv_step, uint32_t t_us){
+	int32_t dt = (int32_t)(t_us - t0);
+	if(dt < 0) dt = 0;
+	return (uint32_t)(((uint64_t)(uint32_t)dt * inv_step) >> 16);
+}
+
+/*
+ * the envelope value at the given position
+ * *done is set when the envelope has reached its end
+ */
+static uint8_t env_value(const uint8_t* knots, uint8_t knot_nb, uint32_t pos, int* done){
+	pos = (pos > 0x10000) ? pos - 0x10000 : 0;		//the first knot is held for a step
+	uint32_t k = pos >> 16;
+	if(k + 1 >= knot_nb){
+		*done = 1;
+		return knots[knot_nb - 1];
 	}
+	*done = 0;
+	int32_t a = knots[k];
+	int32_t v = (a << 16) + (knots[k + 1] - a) * (int32_t)(pos & 0xFFFF);
+	return (uint8_t)((v + 0x8000) >> 16);
 }
 
-static void update_settings(void){
-	PRINT_DBG("sc core proc: update_settings\n");
-	preset = sc_get_current_preset();
-	//set output channels and CCs
+static uint32_t step_q8(const sc_preset_t* p, int delay);
+
+/*
+ * r->preset is the engine's own copy of the preset, written only here and by preset_set_value;
+ * the UI's presets are copied only after a rewrite of whole presets (sc_preset_changed),
+ * a copy torn by another rewrite is dropped (see sc_presets_seq)
+ */
+static void render_derive(sc_render_t* r);
+static void trig_map_build(void);
+
+static void render_build(uint8_t pidx){
+	PRINT_DBG("sc core proc: render_build %d\n",pidx);
+	sc_render_t* r = &render_cache[pidx];
+	sc_preset_t copy;
+	uint32_t seq = sc_presets_seq();
+	__DMB();
+	memcpy(&copy, sc_get_preset(pidx), sizeof(sc_preset_t));
+	__DMB();
+	if( (seq & 1) || (seq != sc_presets_seq()) ){
+		cache_stats.torn++;		//rewritten under us, it comes again with sc_preset_changed
+		return;
+	}
+	r->preset = copy;
+	render_derive(r);
+}
+
+//a single value edited in the UI or by a CC, the UI's copy has it already
+static void preset_set_value(uint8_t pidx, uint8_t vidx, uint8_t v){
+	if( (pidx >= SC_PRESET_NB) || (vidx >= SC_IDX_NB) ) return;
+	sc_render_t* r = &render_cache[pidx];
+	((sc_value_t*)&r->preset)[vidx] = v;
+	render_derive(r);
+	if(r == render){
+		trig_map_build();	//the trigger sources may have changed
+	}
+}
+
+static void render_derive(sc_render_t* r){
+	const sc_preset_t* p = &r->preset;
+	r->shape_nb = 0;
 	for(int i=0;i<SC_OUT_CH_NB;i++){
-		cc_buf[i] = preset->dst_cc[i];
-		ch_buf[i] = preset->dst_ch[i];
+		//set output channels and CCs
+		r->cc[i] = p->dst_cc[i];
+		r->ch[i] = p->dst_ch[i];
+		int depth = (p->dst_depth[i] == SC_DST_FOLLOW) ? p->depth : p->dst_depth[i];
+		if( (r->ch[i] == 0) || (depth <= 0) || !p->active ){
+			r->depth[i] = 0;
+			r->shape_of[i] = SC_SHAPE_FLAT;
+			continue;
+		}
+		r->depth[i] = depth;
+		//find or prepare the shape
+		uint8_t curve = (p->dst_curve[i] == SC_DST_FOLLOW) ? p->curve : p->dst_curve[i];
+		int8_t delay = p->dst_delay[i];
+		int k;
+		for(k=0;k<r->shape_nb;k++){
+			if( (r->shape_curve[k] == curve) && (r->shape_delay[k] == delay) ) break;
+		}
+		if(k == r->shape_nb){
+			r->shape_curve[k] = curve;
+			r->shape_delay[k] = delay;
+			r->shape_knot_nb[k] = build_knots(curve, r->shape_knots[k]);
+			r->shape_inv_step[k] = 0;
+			if( (delay != SC_DST_FOLLOW) || (p->step_div == 0) ){
+				r->shape_inv_step[k] = (uint32_t)((1ULL << 40) / step_q8(p, delay));
+			}
+			r->shape_nb++;
+		}
+		r->shape_of[i] = k;
+	}
+	r->vel_mod = vel_lut_get(p->vel_sens);
+	r->out_valid = 0;	//the destinations may have changed
+	render_gen++;
+	cache_stats.rebuilds++;
+}
+
+/*
+ * trigger map: a bit for every channel/note, set for the trigger sources of the current
+ * preset, so any note is told trigger or not in constant time; the rx side uses it to keep
+ * the other notes out of the input ring, the engine then finds the source in the keys
+ * double buffered: the engine builds the map that isn't in use and switches the pointer,
+ * rx_task only reads through the pointer; trig_map_seq is odd while a map is being built,
+ * so rx_task can tell it has read a map which got rebuilt under it (see trig_map_rx_test)
+ * while a program change waits in the input ring the map is the one of the old preset,
+ * so rx_task lets all the notes through until the engine has taken the program change
+ */
+#define SC_SRC_NB			(1 + SC_XSRC_NB)
+#define TRIG_KEY(ch, note)	((uint16_t)((((ch) - 1) << 7) | (note)))
+#define TRIG_KEY_NONE		0xFFFF
+
+typedef struct {
+	uint8_t bits[16][128 / 8];		//[channel - 1][note / 8]
+	uint16_t keys[SC_SRC_NB];		//channel/note of each source: the index of a matching key is the source
+} sc_trig_map_t;
+
+static sc_trig_map_t trig_maps[2];
+static sc_trig_map_t* volatile trig_map = &trig_maps[0];
+static volatile uint32_t trig_map_seq = 0;
+static volatile uint32_t programs_queued = 0;	//rx_task only
+static volatile uint32_t programs_taken = 0;	//the engine only
+static volatile uint32_t notes_filtered = 0;
+
+static int trig_map_test(const sc_trig_map_t* m, uint8_t ch, uint8_t note){
+	if( (ch < 1) || (ch > 16) || (note > 127) ) return 0;
+	return (m->bits[ch - 1][note >> 3] >> (note & 7)) & 1;
+}
+
+//rx_task side: the note is a trigger or may be one (a program change is pending)
+static int trig_map_rx_test(uint8_t ch, uint8_t note){
+	uint32_t seq;
+	int hit;
+	if(programs_taken != programs_queued) return 1;
+	do{
+		seq = trig_map_seq;
+		__DMB();
+		hit = trig_map_test(trig_map, ch, note);
+		__DMB();
+	}while( (seq & 1) || (seq != trig_map_seq) );
+	return hit;
+}
+
+static void trig_map_build(void){
+	sc_trig_map_t* m = (trig_map == &trig_maps[0]) ? &trig_maps[1] : &trig_maps[0];
+	trig_map_seq++;
+	__DMB();
+	memset(m->bits, 0, sizeof(m->bits));
+	for(int i=0;i<SC_SRC_NB;i++){
+		int ch = (i == 0) ? preset->src_ch : preset->xsrc_ch[i - 1];
+		int note = (i == 0) ? preset->src_note : preset->xsrc_note[i - 1];
+		if( (ch < 1) || (ch > 16) ){
+			m->keys[i] = TRIG_KEY_NONE;		//source off
+			continue;
+		}
+		m->keys[i] = TRIG_KEY(ch, note);
+		m->bits[ch - 1][note >> 3] |= 1 << (note & 7);
+	}
+	__DMB();	//the map must be complete before it's published
+	trig_map = m;
+	__DMB();
+	trig_map_seq++;
+	sc_route_callback(preset);
+}
+
+static void update_settings(uint32_t changed){
+	for(uint8_t pidx=0;pidx<SC_PRESET_NB;pidx++){
+		if(changed & (1UL << pidx)){
+			render_build(pidx);
+		}
+	}
+	if(changed & (1UL << (render - render_cache))){
+		trig_map_build();
 	}
-	//get and prepare curve
-	mod_curve();
 }
 
 void sc_proc_core_info_messages(uint8_t on){
@@ -88,62 +473,725 @@ void sc_proc_core_info_messages(uint8_t on){
 }
 
 
+static int ring_put(uint8_t type, uint8_t d0, uint8_t d1, uint8_t d2, uint32_t t_us){
+	taskENTER_CRITICAL();	//more than one producer
+	uint32_t head = ring_head;
+	if((head - ring_tail) >= SC_RING_LEN){
+		ring_overflows++;
+		taskEXIT_CRITICAL();
+		return -1;
+	}
+	sc_msg_t* msg = &ring[head & (SC_RING_LEN - 1)];
+	msg->t_us = t_us;
+	msg->type = type;
+	msg->d[0] = d0;
+	msg->d[1] = d1;
+	msg->d[2] = d2;
+	__DMB();	//the message must be complete before it's published
+	ring_head = head + 1;
+	taskEXIT_CRITICAL();
+	sc_sched_wake();
+	return 0;
+}
+
+static int ring_get(sc_msg_t* msg){
+	uint32_t tail = ring_tail;
+	if(tail == ring_head) return -1;
+	__DMB();	//don't read the message before seeing it published
+	*msg = ring[tail & (SC_RING_LEN - 1)];
+	__DMB();	//the slot may be reused as soon as it's released
+	ring_tail = tail + 1;
+	return 0;
+}
+
+static void trigger(uint8_t ch, uint8_t note, uint8_t velocity, uint32_t t_us);
+static void preset_select(uint8_t pidx);
+
+/*
+ * runs in the scheduler task whenever the input ring gets a message, a preset changes
+ * or a timed event is due
+ * the messages are processed in order, so a trigger queued before a parameter change
+ * still uses the old settings
+ * the envelopes are rendered by timed events (see voice_start)
+ */
 void sc_proc_core(void){
-	if(sc_preset_changed()){
-		update_settings();
+	sc_msg_t msg;
+	uint32_t changed = sc_preset_changed();
+	if(changed){
+		update_settings(changed);
+	}
+	int selected = sc_preset_selected();	//in the UI or loaded; a program change comes through the ring
+	if(selected >= 0){
+		preset_select(selected);
 	}
-	if( step_delay_cntr > 0){
-	  step_delay_cntr--;
+	while(ring_get(&msg) == 0){
+		switch(msg.type){
+			case SC_MSG_NOTE_ON:
+				trigger(msg.d[0], msg.d[1], msg.d[2], msg.t_us);
+				break;
+			case SC_MSG_CLOCK:
+				sc_tempo_clock(msg.t_us);
+				break;
+			case SC_MSG_SET_VALUE:
+				preset_set_value(msg.d[0], msg.d[1], msg.d[2]);
+				break;
+			case SC_MSG_PROGRAM:
+				preset_select(msg.d[0]);
+				programs_taken++;
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+//change-only output to the destinations of a preset, the unchanged ones are passed with channel 0
+static void out_send(sc_render_t* r, const sc_lanes_t* x){
+	sc_lanes_t ch;
+	int n = 0;
+	for(int w=0;w<SC_OUT_WORDS;w++){
+		uint32_t diff = r->out_valid ? (x->u32[w] ^ r->out_last.u32[w]) : 0xFFFFFFFFUL;
+		ch.u32[w] = lanes4_load(&r->ch[w * 4]) & lanes4_nonzero(diff);
+		n += __builtin_popcount(lanes4_nonzero(ch.u32[w]) & 0x01010101UL);
+	}
+	r->out_last = *x;
+	r->out_valid = 1;
+	if(n == 0) return;
+	render_stats.sent += n;
+	sc_cc_callback(ch.u8, r->cc, r->out_last.u8);
+	if(print_info) xprintf("v=%d ",x->u8[0]);
+}
+
+/*
+ * all the destinations back to 127, except the ones the other preset plays on too
+ * the shared destinations are found pair by pair (SC_OUT_CH_NB^2 compares),
+ * which is fine as it runs only on a preset switch
+ */
+static void out_restore(sc_render_t* r, const sc_render_t* except){
+	sc_lanes_t keep = {0};
+	sc_lanes_t x;
+	if(!r->out_valid) return;
+	for(int i=0;(except != NULL) && (i<SC_OUT_CH_NB);i++){
+		for(int j=0;j<SC_OUT_CH_NB;j++){
+			if( (r->ch[i] != 0) && (r->ch[i] == except->ch[j]) && (r->cc[i] == except->cc[j]) ){
+				keep.u8[i] = 0xFF;	//unchanged, so not sent
+				break;
+			}
+		}
+	}
+	for(int w=0;w<SC_OUT_WORDS;w++){
+		x.u32[w] = (r->out_last.u32[w] & keep.u32[w]) | (LANES4_127 & ~keep.u32[w]);
+	}
+	out_send(r, &x);
+}
+
+/*
+ * the length of one envelope step [us * 256]: step_delay + 1 ticks, or for SC_DST_FOLLOW
+ * the preset step: the note value synced to the MIDI clock if selected and the tempo is known,
+ * otherwise the preset step_delay
+ */
+static uint32_t step_q8(const sc_preset_t* p, int delay){
+	if(delay == SC_DST_FOLLOW){
+		if(p->step_div > 0){
+			uint32_t step = sc_tempo_step_q8(p->step_div);
+			if(step > 0) return step;
+		}
+		delay = p->step_delay;
+	}
+	return ((uint32_t)(delay + 1) * SC_SCHED_TICK_US) << 8;
+}
+
+//the depths at the voice's velocity
+static void voice_depths(sc_voice_t* v){
+	const sc_render_t* s = v->shapes;
+	const uint8_t* row = s->vel_mod[v->velocity & 0x7F];
+	for(int i=0;i<SC_OUT_CH_NB;i++){
+		v->mod.u8[i] = row[s->depth[i]];
+	}
+}
+
+/*
+ * the steps and depths of the voice's shapes and, if it plays on another preset's stream,
+ * which of its destinations goes where; redone after any render cache rebuild
+ * only the steps synced to the tempo need a division here
+ */
+static void voice_refresh(sc_voice_t* v){
+	const sc_render_t* s = v->shapes;
+	for(int k=0;k<s->shape_nb;k++){
+		v->inv_step[k] = s->shape_inv_step[k];
+		if(v->inv_step[k] == 0){
+			v->inv_step[k] = (uint32_t)((1ULL << 40) / step_q8(&s->preset, s->shape_delay[k]));
+		}
+	}
+	voice_depths(v);
+	for(int i=0;(v->render != s) && (i<SC_OUT_CH_NB);i++){
+		v->lane_of[i] = SC_LANE_NONE;
+		for(int j=0;j<SC_OUT_CH_NB;j++){
+			if( (v->render->ch[i] != 0) && (v->render->ch[i] == s->ch[j]) && (v->render->cc[i] == s->cc[j]) ){
+				v->lane_of[i] = j;
+			}
+		}
+	}
+	v->gen = render_gen;
+}
+
+/*
+ * all the destinations of a voice at the given time: the shapes are interpolated,
+ * then spread to the destinations one by one and the depths are applied 4 at a time
+ * returns 1 when all the shapes have reached their end
+ */
+static int voice_lanes(sc_voice_t* v, uint32_t t_us, sc_lanes_t* y){
+	if(v->gen != render_gen) voice_refresh(v);
+	const sc_render_t* s = v->shapes;
+	uint8_t val[SC_OUT_CH_NB + 1];
+	int done_all = 1;
+	for(int k=0;k<s->shape_nb;k++){
+		int done;
+		val[k] = env_value(s->shape_knots[k], s->shape_knot_nb[k], env_pos(v->t0, v->inv_step[k], t_us), &done);
+		done_all &= done;
+	}
+	val[SC_SHAPE_FLAT] = 127;
+	sc_lanes_t x;
+	const sc_lanes_t* mod = &v->mod;
+	sc_lanes_t mod_mapped;
+	if(v->render == s){
+		for(int i=0;i<SC_OUT_CH_NB;i++){
+			x.u8[i] = val[s->shape_of[i]];
+		}
 	}
 	else{
-	  step_delay_cntr = preset->step_delay;
-	  uint8_t value = 127;
-	  if(state < SC_CURVE_LEN){
-	    if(preset->active){
-	      value = current_curve[state];
-	    }
-      sc_cc_callback(ch_buf, cc_buf, value);
-      if(print_info) xprintf("v=%d ",value);
-	    if(value == 127){
-	      state=SC_CURVE_LEN;
-	    }
-	    else{
-	      state++;
-	    }
-	  }//if(state < SC_CURVE_LEN){
-	  else if(state == SC_CURVE_LEN){ //after all the curve point are sent, set volume to max
-      value = 127;
-      SC_PROC_LED_OFF;
-      step_delay_cntr = 0;
-      sc_cc_callback(ch_buf, cc_buf, value);
-      if(print_info) xprintf("v=%d ",value);
-      if(print_info) xprintf("sc done\n");
-      state++;
-	  }
-	}//else to if( step_delay_cntr > 0)
-}
-
-void sc_input_note_on(uint8_t ch, uint8_t note, uint8_t velocity){
-	if( (ch==preset->src_ch) && (note==preset->src_note) ){
-		state = 0;
+		for(int i=0;i<SC_OUT_CH_NB;i++){
+			uint8_t j = v->lane_of[i];
+			x.u8[i] = (j == SC_LANE_NONE) ? 127 : val[s->shape_of[j]];
+			mod_mapped.u8[i] = (j == SC_LANE_NONE) ? 127 : v->mod.u8[j];
+		}
+		mod = &mod_mapped;
+	}
+	for(int w=0;w<SC_OUT_WORDS;w++){
+		y->u32[w] = lanes4_min(lanes4_add(x.u32[w], mod->u32[w]), LANES4_127);
+	}
+	return done_all;
+}
+
+static void combine(uint8_t mode, sc_lanes_t* a, const sc_lanes_t* b){
+	if(mode == SC_COMBINE_PRODUCT){
+		for(int i=0;i<SC_OUT_CH_NB;i++){
+			a->u8[i] = (uint8_t)(((uint32_t)a->u8[i] * b->u8[i] + 63) / 127);
+		}
+		return;
+	}
+	for(int w=0;w<SC_OUT_WORDS;w++){
+		a->u32[w] = lanes4_min(a->u32[w], b->u32[w]);
+	}
+}
+
+/*
+ * computes all the voices at the given time and sends one set of values per preset they play:
+ * the voices of a preset are combined by its combine mode (127 = no effect, both ways);
+ * a voice that reached its end still counts with its final 127 once, then it's free
+ */
+static void mix(uint32_t t_us){
+	sc_render_t* out[SC_VOICE_NB];
+	sc_lanes_t value[SC_VOICE_NB];
+	int out_nb = 0;
+	for(int i=0;i<SC_VOICE_NB;i++){
+		sc_voice_t* v = &voices[i];
+		if(!v->active) continue;
+		sc_lanes_t x;
+		uint32_t c0 = cyccnt_now();
+		int done = voice_lanes(v, t_us, &x);
+		uint32_t cycles = cyccnt_now() - c0;
+		render_stats.renders++;
+		render_stats.cycles_sum += cycles;
+		if(cycles > render_stats.cycles_max) render_stats.cycles_max = cycles;
+		if(done){
+			v->active = 0;
+			voices_active--;
+		}
+		int j;
+		for(j=0;j<out_nb;j++){
+			if(out[j] == v->render) break;
+		}
+		if(j == out_nb){
+			out[out_nb] = v->render;
+			for(int w=0;w<SC_OUT_WORDS;w++) value[out_nb].u32[w] = LANES4_127;
+			out_nb++;
+		}
+		combine(v->render->preset.combine, &value[j], &x);
+	}
+	for(int j=0;j<out_nb;j++){
+		out_send(out[j], &value[j]);
+	}
+}
+
+//a preset switch waiting for the envelope boundary happens here
+static void voices_end(void){
+	mix_running = 0;
+	sc_timeq_cancel(SC_TIMEQ_OWNER_ENVELOPE);
+	SC_PROC_LED_OFF;
+	if(print_info) xprintf("sc done\n");
+	if(render_next != NULL){
+		preset_select(render_next - render_cache);
+	}
+}
+
+static void mix_tick(uint32_t arg){
+	(void)arg;
+	mix(mix_next);
+	if(voices_active == 0){
+		voices_end();
+		return;
+	}
+	mix_next += 1000000 / render_rate_hz;
+	sc_timeq_post(SC_TIMEQ_OWNER_ENVELOPE, mix_next, mix_tick, 0);
+}
+
+//t0 of an envelope started at the given time
+static uint32_t envelope_t0(uint32_t t_us){
+	if( (preset->step_div == 0) || (sc_tempo_step_q8(preset->step_div) == 0) ){
+		return t_us - t_us % SC_SCHED_TICK_US;	//on the millisecond grid, like the steps
+	}
+	return t_us;
+}
+
+static void voice_stop(sc_voice_t* v);
+
+/*
+ * starts an envelope of the current preset in a free voice, or in the oldest one
+ * if all of them are playing; the mixed value goes out right away, then the voices
+ * are mixed on the render period grid until all of them end
+ */
+static sc_voice_t* voice_start(uint8_t src, uint8_t velocity, uint32_t t_us){
+	sc_voice_t* v = NULL;
+	for(int i=0;i<SC_VOICE_NB;i++){
+		if(!voices[i].active){
+			v = &voices[i];
+			break;
+		}
+		if( (v == NULL) || ((int32_t)(voices[i].t0 - v->t0) < 0) ){
+			v = &voices[i];
+		}
+	}
+	if(v->active){
+		voice_stats.stolen++;
+		voice_stop(v);
+	}
+	voices_active++;
+	if(voices_active > voice_stats.active_max) voice_stats.active_max = voices_active;
+	v->t0 = envelope_t0(t_us);
+	v->shapes = render;
+	v->render = render;
+	v->velocity = velocity;
+	voice_refresh(v);
+	v->src = src;
+	v->id = ++voice_ids;
+	v->active = 1;
+	voice_stats.started++;
+	mix(sc_sched_now_us());
+	if(voices_active == 0){
+		voices_end();	//inactive, or the curve is all 127
+		return v;
+	}
+	if(!mix_running){
+		mix_running = 1;
+		mix_next = v->t0 + 1000000 / render_rate_hz;
+		sc_timeq_post(SC_TIMEQ_OWNER_ENVELOPE, mix_next, mix_tick, 0);
+	}
+	SC_PROC_LED_ON;
+	return v;
+}
+
+//stops a voice before its end, the destinations are restored if nothing else plays on them
+static void voice_stop(sc_voice_t* v){
+	if(!v->active) return;
+	v->active = 0;
+	voices_active--;
+	int others = 0;
+	for(int i=0;i<SC_VOICE_NB;i++){
+		if(voices[i].active && (voices[i].render == v->render)) others = 1;
+	}
+	if(!others){
+		out_restore(v->render, NULL);
+	}
+	if(voices_active == 0){
+		voices_end();
+	}
+}
+
+/*
+ * clock-predictive pre-trigger (the main trigger source only)
+ * when the trigger notes keep coming on the clock grid with the same number of clocks
+ * between them, the next one is predicted from the tracked clock phase and the envelope
+ * starts preset->pretrig * SC_PRETRIG_UNIT_US before the note is due, which compensates
+ * the output latency (USB frames, the receiving device)
+ * the note then only confirms the prediction: if it came noticeably off, the rest of
+ * the envelope is moved to follow it; if it doesn't come at all within the window,
+ * the envelope is cancelled and the CCs are restored
+ */
+#define SC_PRETRIG_WINDOW_US		20000	//how far from the prediction a note still confirms it
+#define SC_PRETRIG_CORRECT_US		500		//a confirmed envelope is moved if the note was further off
+#define SC_PRETRIG_MIN_CLOCKS		3		//the grid intervals predicted: from 1/32...
+#define SC_PRETRIG_MAX_CLOCKS		(16 * SC_TEMPO_PPQN)	//...to 4 bars of 4/4
+
+typedef enum {
+	PRETRIG_IDLE = 0,		//nothing predicted
+	PRETRIG_PENDING,		//the next note is predicted, the envelope start is queued
+	PRETRIG_FIRED			//the envelope has started, waiting for the note
+} pretrig_state_t;
+
+static pretrig_state_t pretrig_state = PRETRIG_IDLE;
+static uint32_t pretrig_clock;		//the predicted clock number of the next note...
+static uint32_t pretrig_due;		//...and its time [us]
+static sc_voice_t* pretrig_voice;	//the voice started ahead...
+static uint32_t pretrig_voice_id;	//...unless it was stolen since
+static uint32_t grid_clock;			//the clock number of the last trigger note
+static uint32_t grid_interval;		//clocks between the last two trigger notes
+static uint8_t grid_notes = 0;		//trigger notes seen on the grid (saturates at 2)
+static uint8_t pretrig_velocity = 127;	//the velocity of the last trigger note, until the note comes
+
+static struct {
+	uint32_t predicted;		//envelope starts queued ahead of a note
+	uint32_t fired;			//...started
+	uint32_t hits;			//...confirmed by the note
+	uint32_t corrected;		//...confirmed, but moved to follow the note
+	uint32_t misses;		//...cancelled, the note didn't come
+	uint32_t early;			//the note came before the envelope started
+} pretrig_stats;
+
+static int pretrig_voice_valid(void){
+	return pretrig_voice->active && (pretrig_voice->id == pretrig_voice_id);
+}
+
+static void pretrig_timeout(uint32_t arg){
+	(void)arg;
+	if(pretrig_state != PRETRIG_FIRED) return;
+	pretrig_state = PRETRIG_IDLE;
+	grid_notes = 0;		//the pattern has changed, learn it again
+	if(pretrig_voice_valid()){
+		voice_stop(pretrig_voice);
+	}
+	pretrig_stats.misses++;
+	if(print_info) xprintf("sc pretrigger missed\n");
+}
+
+static void pretrig_fire(uint32_t arg){
+	(void)arg;
+	if(pretrig_state != PRETRIG_PENDING) return;
+	uint32_t lead = (uint32_t)preset->pretrig * SC_PRETRIG_UNIT_US;
+	if( (lead == 0) || (sc_tempo_clock_time(pretrig_clock, &pretrig_due) != 0) ){
+		pretrig_state = PRETRIG_IDLE;
+		return;
+	}
+	//the tempo may have moved since the prediction
+	if((int32_t)(pretrig_due - lead - sc_sched_now_us()) > (int32_t)SC_SCHED_TICK_US){
+		sc_timeq_post(SC_TIMEQ_OWNER_PRETRIG, pretrig_due - lead, pretrig_fire, 0);
+		return;
+	}
+	pretrig_voice = voice_start(0, pretrig_velocity, pretrig_due - lead);
+	pretrig_voice_id = pretrig_voice->id;
+	pretrig_state = PRETRIG_FIRED;
+	sc_timeq_post(SC_TIMEQ_OWNER_PRETRIG, pretrig_due + SC_PRETRIG_WINDOW_US, pretrig_timeout, 0);
+	pretrig_stats.fired++;
+	if(print_info) xprintf("*sc pretrigger: ");
+}
+
+/*
+ * called for every note of the main trigger source
+ * returns 0 if the note confirmed an envelope already started by the pre-trigger
+ */
+static int pretrig_confirm(uint8_t velocity, uint32_t t_us){
+	pretrig_state_t state = pretrig_state;
+	if(state == PRETRIG_IDLE) return -1;
+	sc_timeq_cancel(SC_TIMEQ_OWNER_PRETRIG);
+	pretrig_state = PRETRIG_IDLE;
+	if(state == PRETRIG_PENDING){
+		pretrig_stats.early++;
+		return -1;
+	}
+	int32_t off = (int32_t)(t_us - pretrig_due);
+	if( (off > SC_PRETRIG_WINDOW_US) || (off < -SC_PRETRIG_WINDOW_US) ){
+		pretrig_stats.misses++;		//some other note, the timeout just didn't run yet
+		return -1;
+	}
+	pretrig_stats.hits++;
+	if( pretrig_voice_valid() && (pretrig_voice->velocity != velocity) ){
+		pretrig_voice->velocity = velocity;		//the depths follow the actual note
+		voice_depths(pretrig_voice);
+	}
+	if( (off > SC_PRETRIG_CORRECT_US) || (off < -SC_PRETRIG_CORRECT_US) ){
+		//the rest of the envelope follows the note
+		if(pretrig_voice_valid()){
+			pretrig_voice->t0 = envelope_t0(t_us - (uint32_t)preset->pretrig * SC_PRETRIG_UNIT_US);
+		}
+		pretrig_stats.corrected++;
+	}
+	return 0;
+}
+
+//places the trigger note on the clock grid and predicts the next one
+static void pretrig_learn(uint32_t t_us){
+	uint32_t pos_q8;
+	if( (preset->pretrig == 0) || (sc_tempo_position_q8(t_us, &pos_q8) != 0) ){
+		grid_notes = 0;
+		return;
+	}
+	uint32_t clock = (pos_q8 + 128) >> 8;
+	uint32_t interval = clock - grid_clock;
+	grid_clock = clock;
+	if(grid_notes < 2){
+		grid_notes++;
+		grid_interval = interval;
+		return;
+	}
+	if( (interval != grid_interval) || (interval < SC_PRETRIG_MIN_CLOCKS) || (interval > SC_PRETRIG_MAX_CLOCKS) ){
+		grid_interval = interval;
+		return;
+	}
+	pretrig_clock = clock + interval;
+	if(sc_tempo_clock_time(pretrig_clock, &pretrig_due) != 0) return;
+	pretrig_state = PRETRIG_PENDING;
+	sc_timeq_post(SC_TIMEQ_OWNER_PRETRIG, pretrig_due - (uint32_t)preset->pretrig * SC_PRETRIG_UNIT_US, pretrig_fire, 0);
+	pretrig_stats.predicted++;
+}
+
+static int dst_overlap(const sc_render_t* a, const sc_render_t* b){
+	for(int i=0;i<SC_OUT_CH_NB;i++){
+		if(a->ch[i] == 0) continue;
+		for(int j=0;j<SC_OUT_CH_NB;j++){
+			if( (a->ch[i] == b->ch[j]) && (a->cc[i] == b->cc[j]) ) return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * preset switch: the engine moves to the preset's render cache entry
+ * SC_SWITCH_AT_BOUNDARY: the running envelopes end first, with the old preset;
+ * notes until then are matched against the old preset too
+ * SC_SWITCH_IMMEDIATE: new notes use the new preset right away, the running envelopes
+ * still finish with the data they started with; they keep their old destinations
+ * unless the new preset shares some, then they join its stream on the shared ones, so that
+ * a destination never gets two streams at once; the rest of the old ones are restored
+ */
+static void preset_switch(sc_render_t* r){
+	for(int i=0;i<SC_VOICE_NB;i++){
+		sc_voice_t* v = &voices[i];
+		if(v->active && (v->render != r) && dst_overlap(v->render, r)){
+			sc_render_t* old = v->render;
+			v->render = r;
+			voice_refresh(v);
+			int others = 0;
+			for(int j=0;j<SC_VOICE_NB;j++){
+				if(voices[j].active && (voices[j].render == old)) others = 1;
+			}
+			if(!others){
+				out_restore(old, r);
+			}
+		}
+	}
+	render = r;
+	preset = &r->preset;
+	render_next = NULL;
+	trig_map_build();
+	cache_stats.switches++;
+	//the prediction was made for the old preset
+	if(pretrig_state == PRETRIG_PENDING){
+		sc_timeq_cancel(SC_TIMEQ_OWNER_PRETRIG);
+		pretrig_state = PRETRIG_IDLE;
+	}
+	grid_notes = 0;
+}
+
+static void preset_select(uint8_t pidx){
+	if(pidx >= SC_PRESET_NB) return;
+	sc_render_t* r = &render_cache[pidx];
+	if(r == render){
+		render_next = NULL;		//switched back before the envelopes ended
+		return;
+	}
+	if( (switch_policy == SC_SWITCH_AT_BOUNDARY) && (voices_active > 0) ){
+		if(render_next == NULL) cache_stats.deferred++;
+		render_next = r;
+		return;
+	}
+	preset_switch(r);
+}
+
+/*
+ * which trigger source of the current preset the note is: 0 = src_ch/src_note,
+ * 1.. = xsrc_ch/xsrc_note; -1 = not a trigger
+ */
+static int trigger_source(uint8_t ch, uint8_t note){
+	const sc_trig_map_t* m = trig_map;
+	if(!trig_map_test(m, ch, note)) return -1;
+	uint16_t key = TRIG_KEY(ch, note);
+	for(int i=0;i<SC_SRC_NB;i++){
+		if(m->keys[i] == key) return i;
+	}
+	return -1;
+}
+
+/*
+ * t_us is the arrival time of the note, so the envelope phase doesn't depend on
+ * how long the note waited in the queues before it got here
+ */
+static void trigger(uint8_t ch, uint8_t note, uint8_t velocity, uint32_t t_us){
+	int src = trigger_source(ch, note);
+	if(src >= 0){
+		trig_age_last = sc_sched_now_us() - t_us;
+		if(trig_age_last > trig_age_max) trig_age_max = trig_age_last;
 		//PRINT_DBG("sc_input_note_on: TRIG! ch=%d, note=%d, v=%d\n",ch,note,velocity);
-		if(preset->active){
-		  sc_cc_callback(ch_buf,cc_buf,current_curve[state]);
+		if( (src != 0) || (pretrig_confirm(velocity, t_us) != 0) ){
+			voice_start(src, velocity, t_us);
+			if(print_info)xprintf("*sc%c: ",'A' + src);
 		}
-		else{
-		  sc_cc_callback(ch_buf,cc_buf,127);
+		if(src == 0){
+			pretrig_velocity = velocity;
+			pretrig_learn(t_us);
 		}
-		step_delay_cntr = preset->step_delay;
-    SC_PROC_LED_ON;
-		if(print_info)xprintf("*sc: ");
 	}
 	else{
 		//PRINT_DBG("sc_input_note_on: ignored: ch=%d, note=%d, v=%d\n",ch,note,velocity);
 	}
 }
 
-__weak void sc_cc_callback(uint8_t* chbuf, uint8_t *ccbuf, uint8_t value){
-  if(print_info) xprintf("*v=%d\n",value);
+
+//producer side of the input ring, rx_task only
+//t_us - arrival time of the note (sc_sched_now_us timebase)
+//the notes that trigger nothing in the current preset stop here
+void sc_input_note_on(uint8_t ch, uint8_t note, uint8_t velocity, uint32_t t_us){
+	if(velocity == 0){
+		return;		//a note-off sent as a note-on (running status), the engine doesn't use note-offs
+	}
+	if(!trig_map_rx_test(ch, note)){
+		notes_filtered++;
+		return;
+	}
+	if(ring_put(SC_MSG_NOTE_ON, ch, note, velocity, t_us) != 0){
+		xprintf("sc_input_note_on: input ring full\n");
+	}
+}
+
+//t_us - arrival time of the 0xF8 timing clock
+void sc_input_clock(uint32_t t_us){
+	if(ring_put(SC_MSG_CLOCK, 0, 0, 0, t_us) != 0){
+		xprintf("sc_input_clock: input ring full\n");
+	}
+}
+
+void sc_input_program(uint8_t pidx){
+	if(ring_put(SC_MSG_PROGRAM, pidx, 0, 0, sc_sched_now_us()) != 0){
+		xprintf("sc_input_program: input ring full\n");
+		return;
+	}
+	programs_queued++;
+}
+
+void sc_input_set_value(uint8_t pidx, sc_idx_t vidx, uint8_t v){
+	if(ring_put(SC_MSG_SET_VALUE, pidx, (uint8_t)vidx, v, sc_sched_now_us()) != 0){
+		xprintf("sc_input_set_value: input ring full\n");
+	}
+}
+
+
+void sc_proc_print_stats(void){
+	xprintf("sc_proc: input ring overflows=%u, notes filtered=%u, trigger age last=%uus max=%uus\n",
+			(unsigned int)ring_overflows,(unsigned int)notes_filtered,(unsigned int)trig_age_last,(unsigned int)trig_age_max);
+	xprintf("sc_proc: pretrigger predicted=%u fired=%u hits=%u corrected=%u misses=%u early=%u\n",
+			(unsigned int)pretrig_stats.predicted,(unsigned int)pretrig_stats.fired,(unsigned int)pretrig_stats.hits,
+			(unsigned int)pretrig_stats.corrected,(unsigned int)pretrig_stats.misses,(unsigned int)pretrig_stats.early);
+	xprintf("sc_proc: render rate=%uHz, renders=%u sent=%u, cycles avg=%u max=%u\n",
+			(unsigned int)render_rate_hz,(unsigned int)render_stats.renders,(unsigned int)render_stats.sent,
+			(unsigned int)(render_stats.renders ? render_stats.cycles_sum / render_stats.renders : 0),
+			(unsigned int)render_stats.cycles_max);
+	xprintf("sc_proc: preset=%u, switch %s, switches=%u deferred=%u, cache rebuilds=%u torn=%u\n",
+			(unsigned int)(render - render_cache),(switch_policy == SC_SWITCH_IMMEDIATE) ? "immediate" : "at envelope end",
+			(unsigned int)cache_stats.switches,(unsigned int)cache_stats.deferred,(unsigned int)cache_stats.rebuilds,(unsigned int)cache_stats.torn);
+	xprintf("sc_proc: voices %u/%u active (max %u), started=%u stolen=%u\n",
+			(unsigned int)voices_active,(unsigned int)SC_VOICE_NB,(unsigned int)voice_stats.active_max,
+			(unsigned int)voice_stats.started,(unsigned int)voice_stats.stolen);
+}
+
+void sc_proc_reset_stats(void){
+	trig_age_max = 0;
+	memset(&pretrig_stats, 0, sizeof(pretrig_stats));
+	memset(&render_stats, 0, sizeof(render_stats));
+	memset(&cache_stats, 0, sizeof(cache_stats));
+	memset(&voice_stats, 0, sizeof(voice_stats));
+}
+
+void sc_proc_set_switch_policy(uint8_t policy){
+	switch_policy = policy;
+}
+
+uint8_t sc_proc_get_switch_policy(void){
+	return switch_policy;
+}
+
+void sc_proc_set_render_rate(uint32_t hz){
+	if(hz == 0) hz = 1;
+	if(hz > SC_RENDER_RATE_MAX_HZ) hz = SC_RENDER_RATE_MAX_HZ;
+	render_rate_hz = hz;
+}
+
+uint32_t sc_proc_get_render_rate(void){
+	return render_rate_hz;
+}
+
+/*
+ * renders every curve with the current preset's depth and step at the current rate,
+ * without sending anything, and prints the cost of a render and the number of CCs
+ * it would send compared to the former point-by-point output
+ * runs in the calling task, the engine isn't affected
+ */
+void sc_proc_render_bench(void){
+	static uint8_t knots[SC_CURVE_LEN_MAX + 1];
+	sc_preset_t* p = sc_get_current_preset();
+	uint32_t step = ((uint32_t)(p->step_delay + 1) * SC_SCHED_TICK_US) << 8;
+	uint32_t inv_step = (uint32_t)((1ULL << 40) / step);
+	uint32_t period = 1000000 / render_rate_hz;
+	uint8_t mod = depth_mod(p->depth, 1);
+	xprintf("sc render bench: rate=%uHz, step=%uus, depth=%d\n",
+			(unsigned int)render_rate_hz,(unsigned int)(step >> 8),p->depth);
+	for(uint8_t curve=0;curve<SC_CURVE_NB;curve++){
+		uint8_t knot_nb = build_knots(curve, knots);
+		uint32_t renders = 0, changes = 1, sum = 0, max = 0;
+		uint16_t last = (knots[0] + mod > 127) ? 127 : knots[0] + mod;
+		int done = 0;
+		for(uint32_t t = period; !done; t += period){
+			uint32_t c0 = cyccnt_now();
+			uint32_t v = env_value(knots, knot_nb, env_pos(0, inv_step, t), &done) + mod;
+			if(v > 127) v = 127;
+			uint32_t cycles = cyccnt_now() - c0;
+			sum += cycles;
+			if(cycles > max) max = cycles;
+			renders++;
+			if(v != last){
+				changes++;
+				last = v;
+			}
+		}
+		//the former output: the first point, every point up to the first 127 with the depth, the final restore
+		uint32_t was = 0;
+		while(knots[was] + mod < 127) was++;		//the curve ends with 127, so this stops
+		was++;
+		was += 1 + (was <= sc_curve_get_len(curve));
+		xprintf(" %-8s: %u renders, %u cycles avg, %u max, %u CCs (was %u)\n",
+				sc_curve_get_name(curve),(unsigned int)renders,(unsigned int)(sum / renders),(unsigned int)max,
+				(unsigned int)changes,(unsigned int)was);
+	}
+}
+
+/*
+ * called by the engine whenever the current preset or its routing changes,
+ * e.g. to narrow down the MIDI input to what the preset listens to
+ */
+__weak void sc_route_callback(const sc_preset_t* preset){
+	(void)preset;
+}
+
+__weak void sc_cc_callback(uint8_t* chbuf, uint8_t *ccbuf, uint8_t *values){
+  if(print_info) xprintf("*v=%d\n",values[0]);
 	/*xprintf("channels:\n");
 	debug_hexbuf(chbuf, 4);
 	xprintf("CCs:\n");
@@ -0,0 +1,199 @@
+/*
+* The MIT License (MIT)
+* Copyright (c) 2025 Ada Brzoza-Zajecka (Locriana)
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+* THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+ * Envelope scheduler
+ *
+ * Runs the sidechain engine (sc_proc_core) from a dedicated top-priority task.
+ * The task sleeps until the next timed event is due (sc_timeq_next_due) or until
+ * sc_sched_wake() tells it the MIDI input has put a message in the engine's input
+ * ring (or a preset was edited), so an idle engine doesn't wake up at all.
+ *
+ * TIM1 counts microseconds over its full 16-bit range; its update interrupt
+ * only counts the wraps, which makes the microsecond timebase (sc_sched_now_us).
+ * The next deadline is set in the compare channel 1, whose interrupt wakes the task;
+ * a deadline further than one wrap away matches on the earlier wraps too, those
+ * matches are ignored.
+ */
+
+#include "main.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "cmsis_os.h"
+#include "dbgu.h"
+#include "sc_sched.h"
+#include "sc_proc.h"
+#include "sc_timeq.h"
+
+//task notification bits
+#define SC_SCHED_EV_DEADLINE    0x01
+#define SC_SCHED_EV_INPUT       0x02
+#define SC_SCHED_EV_ALL         0xFFFFFFFFUL
+
+extern TIM_HandleTypeDef htim1;
+
+static TaskHandle_t sched_task_handle = NULL;
+static volatile sc_sched_stats_t stats;
+static volatile uint32_t wrap_count = 0;	//never reset, the base of sc_sched_now_us
+static volatile uint32_t deadline;			//the compare is armed for this time [us]
+
+/*
+ * sets the compare for the next timed event, or disarms it if there's none
+ * if the event is due already (or became due while the compare was being set),
+ * the task notifies itself instead
+ */
+static void deadline_arm(void){
+  uint32_t due;
+  __HAL_TIM_DISABLE_IT(&htim1, TIM_IT_CC1);
+  if(sc_timeq_next_due(&due) != 0) return;
+  deadline = due;
+  __HAL_TIM_SET_COMPARE(&htim1, TIM_CHANNEL_1, due & (SC_SCHED_WRAP_US - 1));
+  __HAL_TIM_CLEAR_FLAG(&htim1, TIM_FLAG_CC1);
+  __HAL_TIM_ENABLE_IT(&htim1, TIM_IT_CC1);
+  if((int32_t)(sc_sched_now_us() - due) >= 0){
+    __HAL_TIM_DISABLE_IT(&htim1, TIM_IT_CC1);
+    xTaskNotify(sched_task_handle, SC_SCHED_EV_DEADLINE, eSetBits);
+  }
+}
+
+static void sched_task(void* params){
+  while(1){
+    uint32_t events = 0;
+    xTaskNotifyWait(0, SC_SCHED_EV_ALL, &events, portMAX_DELAY);
+    stats.wakeups++;
+
+    if(events & SC_SCHED_EV_DEADLINE){
+      uint32_t latency = sc_sched_now_us() - deadline;
+      stats.deadlines++;
+      if(latency > SC_SCHED_LATE_US){
+        stats.late++;
+      }
+      if(latency > stats.latency_max){
+        stats.latency_max = latency;
+      }
+      stats.latency_last = latency;
+    }
+    if(events & SC_SCHED_EV_INPUT){
+      stats.inputs++;
+    }
+
+    //input messages are handled right away, the timed events when they are due
+    sc_proc_core();
+    sc_timeq_run(sc_sched_now_us());
+    deadline_arm();
+  }
+}
+
+void sc_sched_wrap_isr(void){
+  wrap_count++;
+}
+
+void sc_sched_deadline_isr(void){
+  BaseType_t woken = pdFALSE;
+  if((int32_t)(sc_sched_now_us() - deadline) < 0) return;	//a match on an earlier wrap
+  __HAL_TIM_DISABLE_IT(&htim1, TIM_IT_CC1);
+  if(sched_task_handle != NULL){
+    xTaskNotifyFromISR(sched_task_handle, SC_SCHED_EV_DEADLINE, eSetBits, &woken);
+  }
+  portYIELD_FROM_ISR(woken);
+}
+
+//wakes the engine up when there's new input, from a task
+void sc_sched_wake(void){
+  if(sched_task_handle != NULL){
+    xTaskNotify(sched_task_handle, SC_SCHED_EV_INPUT, eSetBits);
+  }
+}
+
+/*
+ * microseconds since the scheduler was started (wraps after ~71 minutes)
+ * if the update interrupt is pending (e.g. called with interrupts masked),
+ * the counter has already wrapped, so the wrap is added here
+ */
+uint32_t sc_sched_now_us(void){
+  uint32_t wraps, cnt, wrapped;
+  do{
+    wraps = wrap_count;
+    cnt = __HAL_TIM_GET_COUNTER(&htim1);
+    wrapped = __HAL_TIM_GET_FLAG(&htim1, TIM_FLAG_UPDATE) && (cnt < (SC_SCHED_WRAP_US / 2));
+  }while(wraps != wrap_count);	//the update interrupt came in between
+  if(wrapped) wraps++;
+  return wraps * SC_SCHED_WRAP_US + cnt;
+}
+
+int sc_sched_init(void){
+  BaseType_t res = xTaskCreate(sched_task, "sched", configMINIMAL_STACK_SIZE + 256, NULL, osPriorityRealtime, &sched_task_handle);
+  if(res != pdPASS){
+    xprintf("sc_sched: sched_task not created\n");
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * starts the timebase and runs the engine once, it then schedules itself
+ * must be called after sc_init(), otherwise the engine would run without any preset
+ */
+void sc_sched_start(void){
+  if(HAL_TIM_Base_Start_IT(&htim1) != HAL_OK){
+    xprintf("sc_sched: could not start TIM1\n");
+    return;
+  }
+  sc_sched_reset_stats();
+  sc_sched_wake();
+  xprintf("sc_sched: started, tickless\n");
+}
+
+void sc_sched_stop(void){
+  __HAL_TIM_DISABLE_IT(&htim1, TIM_IT_CC1);
+  HAL_TIM_Base_Stop_IT(&htim1);
+}
+
+void sc_sched_get_stats(sc_sched_stats_t* p_stats){
+  taskENTER_CRITICAL();
+  *p_stats = stats;
+  taskEXIT_CRITICAL();
+}
+
+void sc_sched_reset_stats(void){
+  taskENTER_CRITICAL();
+  stats.wakeups = 0;
+  stats.deadlines = 0;
+  stats.inputs = 0;
+  stats.late = 0;
+  stats.latency_max = 0;
+  stats.latency_last = 0;
+  stats.t_reset = sc_sched_now_us();
+  taskEXIT_CRITICAL();
+  sc_proc_reset_stats();
+}
+
+void sc_sched_print_stats(void){
+  sc_sched_stats_t s;
+  sc_sched_get_stats(&s);
+  uint32_t elapsed_ms = (sc_sched_now_us() - s.t_reset) / 1000;
+  xprintf("sc_sched: wakeups=%u (%u/s) deadlines=%u inputs=%u late=%u (>%dus)\n",
+      (unsigned int)s.wakeups,(unsigned int)(elapsed_ms ? (uint64_t)s.wakeups * 1000 / elapsed_ms : 0),
+      (unsigned int)s.deadlines,(unsigned int)s.inputs,(unsigned int)s.late,SC_SCHED_LATE_US);
+  xprintf("sc_sched: latency last=%uus max=%uus\n",(unsigned int)s.latency_last,(unsigned int)s.latency_max);
+  sc_proc_print_stats();
+}
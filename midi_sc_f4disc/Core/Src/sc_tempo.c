@@ -0,0 +1,193 @@
+/*
+* The MIT License (MIT)
+* Copyright (c) 2025 Ada Brzoza-Zajecka (Locriana)
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+* THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+ * MIDI clock tempo tracker
+ *
+ * A second order PLL follows the incoming 0xF8 clocks (timestamped at USB frame
+ * arrival, so they come with up to ~1 ms of jitter, sometimes more):
+ * the phase is the tracked time of the last clock, the period is the estimated
+ * clock interval; both are kept with 1/256 us resolution.
+ * For every clock the phase error against the prediction corrects the phase
+ * by 1/SC_TEMPO_PHASE_GAIN and the period by 1/SC_TEMPO_PERIOD_GAIN of it,
+ * so the jitter is averaged out while the tempo changes are still followed.
+ * Missing clocks (n periods elapsed) are tolerated, a longer gap starts over.
+ */
+
+#include "main.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "dbgu.h"
+#include "sc_tempo.h"
+
+#define SC_TEMPO_PHASE_GAIN		4
+#define SC_TEMPO_PERIOD_GAIN	64
+#define SC_TEMPO_JITTER_AVG		16
+#define SC_TEMPO_MAX_MISSING	4		//more missing clocks than this means that the clock has stopped
+
+#define PERIOD_MIN_Q8	((uint32_t)((60000000ULL * 256) / (SC_TEMPO_MAX_BPM * SC_TEMPO_PPQN)))
+#define PERIOD_MAX_Q8	((uint32_t)((60000000ULL * 256) / (SC_TEMPO_MIN_BPM * SC_TEMPO_PPQN)))
+
+typedef struct {
+	const char* name;
+	uint8_t per_quarter;	//steps per quarter note
+} sc_tempo_div_t;
+
+static const sc_tempo_div_t divs[SC_TEMPO_DIV_NB] = {
+	{"Off", 0}, {"1/256", 64}, {"1/128T", 48}, {"1/128", 32}, {"1/64T", 24},
+	{"1/64", 16}, {"1/32T", 12}, {"1/32", 8}, {"1/16T", 6}, {"1/16", 4}
+};
+
+static sc_tempo_t tempo;
+static uint32_t phase_us;		//tracked time of the last clock...
+static int32_t phase_frac;		//...and its fraction [us / 256]
+static int32_t jitter_q8;
+static uint32_t clock_idx;		//the number of the last clock, counted across gaps and restarts
+
+static void restart(uint32_t t_us){
+	if(tempo.clocks > 1) tempo.relocks++;
+	tempo.locked = 0;
+	tempo.clocks = 1;
+	clock_idx++;
+	phase_us = t_us;
+	phase_frac = 0;
+}
+
+void sc_tempo_clock(uint32_t t_us){
+	if(tempo.clocks == 0){
+		restart(t_us);
+		return;
+	}
+
+	int32_t elapsed = (int32_t)(t_us - phase_us);
+	if( (elapsed < 0) || (elapsed > (int32_t)((PERIOD_MAX_Q8 >> 8) * (SC_TEMPO_MAX_MISSING + 1))) ){
+		restart(t_us);
+		return;
+	}
+	int32_t elapsed_q8 = elapsed * 256 - phase_frac;
+
+	if(tempo.clocks == 1){
+		//the first interval is the initial estimate
+		if( (elapsed_q8 < (int32_t)PERIOD_MIN_Q8) || (elapsed_q8 > (int32_t)PERIOD_MAX_Q8) ){
+			restart(t_us);
+			return;
+		}
+		tempo.period_q8 = elapsed_q8;
+		tempo.clocks = 2;
+		clock_idx++;
+		phase_us = t_us;
+		phase_frac = 0;
+		jitter_q8 = 0;
+		return;
+	}
+
+	//how many periods have passed (more than one if some clocks got lost)
+	int32_t period = (int32_t)tempo.period_q8;
+	int32_t n = (elapsed_q8 + period / 2) / period;
+	if(n < 1) n = 1;	//two clocks in one USB frame
+	if(n > SC_TEMPO_MAX_MISSING + 1){
+		restart(t_us);
+		return;
+	}
+	int32_t err = elapsed_q8 - n * period;
+	if(err > period / 2) err = period / 2;
+	if(err < -period / 2) err = -period / 2;
+
+	//PLL update
+	int32_t advance = phase_frac + n * period + err / SC_TEMPO_PHASE_GAIN;
+	phase_us += advance >> 8;
+	phase_frac = advance & 0xFF;
+	clock_idx += n;
+	period += err / (SC_TEMPO_PERIOD_GAIN * n);
+	if(period < (int32_t)PERIOD_MIN_Q8) period = PERIOD_MIN_Q8;
+	if(period > (int32_t)PERIOD_MAX_Q8) period = PERIOD_MAX_Q8;
+
+	uint32_t abs_err = (err < 0) ? -err : err;
+	jitter_q8 += ((int32_t)abs_err - jitter_q8) / SC_TEMPO_JITTER_AVG;
+
+	taskENTER_CRITICAL();	//the numbers are read by the UI
+	tempo.period_q8 = period;
+	tempo.bpm_x100 = (uint32_t)((60000000ULL * 100 * 256) / ((uint64_t)period * SC_TEMPO_PPQN));
+	tempo.jitter_us = jitter_q8 >> 8;
+	tempo.clocks++;
+	if(tempo.clocks >= SC_TEMPO_LOCK_CLOCKS){
+		if(!tempo.locked){
+			tempo.locked = 1;
+			tempo.jitter_max_us = 0;
+		}
+		if((abs_err >> 8) > tempo.jitter_max_us) tempo.jitter_max_us = abs_err >> 8;
+	}
+	taskEXIT_CRITICAL();
+}
+
+/*
+ * the length of one step of the given division [us * 256]
+ * returns 0 if the division is off or the tempo is unknown
+ */
+uint32_t sc_tempo_step_q8(uint8_t div){
+	if( (div == 0) || (div >= SC_TEMPO_DIV_NB) || !tempo.locked ) return 0;
+	return (tempo.period_q8 * SC_TEMPO_PPQN) / divs[div].per_quarter;
+}
+
+/*
+ * where the given time falls on the tracked clock grid [clocks * 256],
+ * counted like the clock numbers below; the time can be before or after the last clock
+ * returns -1 if the tempo is unknown
+ */
+int sc_tempo_position_q8(uint32_t t_us, uint32_t* pos_q8){
+	if(!tempo.locked) return -1;
+	int64_t dt_q8 = (int64_t)(int32_t)(t_us - phase_us) * 256 - phase_frac;
+	*pos_q8 = clock_idx * 256 + (int32_t)((dt_q8 * 256) / (int32_t)tempo.period_q8);
+	return 0;
+}
+
+/*
+ * the predicted time of the given clock number (see sc_tempo_position_q8)
+ * returns -1 if the tempo is unknown
+ */
+int sc_tempo_clock_time(uint32_t clock, uint32_t* t_us){
+	if(!tempo.locked) return -1;
+	int64_t dt_q8 = (int64_t)(int32_t)(clock - clock_idx) * tempo.period_q8 + phase_frac;
+	*t_us = phase_us + (int32_t)(dt_q8 >> 8);
+	return 0;
+}
+
+const char* sc_tempo_div_name(uint8_t div){
+	if(div >= SC_TEMPO_DIV_NB) return "?";
+	return divs[div].name;
+}
+
+void sc_tempo_get(sc_tempo_t* p_tempo){
+	taskENTER_CRITICAL();
+	*p_tempo = tempo;
+	taskEXIT_CRITICAL();
+}
+
+void sc_tempo_print(void){
+	sc_tempo_t t;
+	sc_tempo_get(&t);
+	xprintf("sc_tempo: %s, bpm=%u.%02u, clock period=%u.%02uus, jitter avg=%uus max=%uus, clocks=%u relocks=%u\n",
+			t.locked ? "locked" : "not locked",
+			(unsigned int)(t.bpm_x100 / 100),(unsigned int)(t.bpm_x100 % 100),
+			(unsigned int)(t.period_q8 >> 8),(unsigned int)(((t.period_q8 & 0xFF) * 100) >> 8),
+			(unsigned int)t.jitter_us,(unsigned int)t.jitter_max_us,(unsigned int)t.clocks,(unsigned int)t.relocks);
+}
@@ -0,0 +1,199 @@
+/*
+* The MIT License (MIT)
+* Copyright (c) 2025 Ada Brzoza-Zajecka (Locriana)
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+* OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+* OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+* THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+ * Timed event queue
+ *
+ * A binary min-heap of events keyed on their due time in microseconds.
+ * Posting and cancelling is done from any task, dispatching from the scheduler
+ * task only. The heap is protected with short critical sections; the event
+ * functions are called outside of them, so they may post new events.
+ * Time comparisons are wrap-safe as long as all the due times are within
+ * ~35 minutes from now.
+ */
+
+#include "main.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "dbgu.h"
+#include "sc_timeq.h"
+
+typedef struct {
+	uint32_t due_us;
+	sc_timeq_fn_t fn;
+	uint32_t arg;
+	uint8_t owner;
+} sc_timeq_event_t;
+
+static sc_timeq_event_t heap[SC_TIMEQ_LEN];
+static uint16_t heap_nb = 0;
+static volatile sc_timeq_stats_t stats;
+
+static inline int earlier(const sc_timeq_event_t* a, const sc_timeq_event_t* b){
+	return (int32_t)(a->due_us - b->due_us) < 0;
+}
+
+static void swap(uint16_t a, uint16_t b){
+	sc_timeq_event_t temp = heap[a];
+	heap[a] = heap[b];
+	heap[b] = temp;
+}
+
+static void sift_up(uint16_t idx){
+	while(idx > 0){
+		uint16_t parent = (idx - 1) / 2;
+		if(!earlier(&heap[idx], &heap[parent])) break;
+		swap(idx, parent);
+		idx = parent;
+	}
+}
+
+static void sift_down(uint16_t idx){
+	while(1){
+		uint16_t left = 2 * idx + 1;
+		uint16_t right = left + 1;
+		uint16_t min = idx;
+		if( (left < heap_nb) && earlier(&heap[left], &heap[min]) ) min = left;
+		if( (right < heap_nb) && earlier(&heap[right], &heap[min]) ) min = right;
+		if(min == idx) break;
+		swap(idx, min);
+		idx = min;
+	}
+}
+
+//removes the event at idx, must be called inside a critical section
+static void remove_at(uint16_t idx){
+	heap_nb--;
+	if(idx == heap_nb) return;
+	heap[idx] = heap[heap_nb];
+	sift_down(idx);
+	sift_up(idx);
+}
+
+/*
+ * queues fn(arg) to be called at due_us
+ * returns 0 if queued, -1 if the queue is full
+ */
+int sc_timeq_post(uint8_t owner, uint32_t due_us, sc_timeq_fn_t fn, uint32_t arg){
+	int res = -1;
+	taskENTER_CRITICAL();
+	if(heap_nb < SC_TIMEQ_LEN){
+		heap[heap_nb].due_us = due_us;
+		heap[heap_nb].fn = fn;
+		heap[heap_nb].arg = arg;
+		heap[heap_nb].owner = owner;
+		heap_nb++;
+		sift_up(heap_nb - 1);
+		stats.posted++;
+		if(heap_nb > stats.pending_max) stats.pending_max = heap_nb;
+		res = 0;
+	}
+	else{
+		stats.overflows++;
+	}
+	taskEXIT_CRITICAL();
+	return res;
+}
+
+/*
+ * removes all the pending events of the owner
+ * returns the number of removed events
+ */
+uint16_t sc_timeq_cancel(uint8_t owner){
+	uint16_t removed = 0;
+	taskENTER_CRITICAL();
+	uint16_t idx = 0;
+	while(idx < heap_nb){
+		if(heap[idx].owner == owner){
+			remove_at(idx);	//another event lands at idx, check it again
+			removed++;
+		}
+		else{
+			idx++;
+		}
+	}
+	stats.cancelled += removed;
+	taskEXIT_CRITICAL();
+	return removed;
+}
+
+/*
+ * dispatches all the events due at now_us or earlier, in the order of their due times
+ */
+void sc_timeq_run(uint32_t now_us){
+	while(1){
+		sc_timeq_event_t event;
+		taskENTER_CRITICAL();
+		if( (heap_nb == 0) || ((int32_t)(now_us - heap[0].due_us) < 0) ){
+			taskEXIT_CRITICAL();
+			return;
+		}
+		event = heap[0];
+		remove_at(0);
+		taskEXIT_CRITICAL();
+
+		uint32_t late = now_us - event.due_us;
+		if(late > stats.late_max) stats.late_max = late;
+		stats.fired++;
+		event.fn(event.arg);
+	}
+}
+
+/*
+ * gets the due time of the earliest event
+ * returns 0 if there is one, -1 if the queue is empty
+ */
+int sc_timeq_next_due(uint32_t* due_us){
+	int res = -1;
+	taskENTER_CRITICAL();
+	if(heap_nb > 0){
+		*due_us = heap[0].due_us;
+		res = 0;
+	}
+	taskEXIT_CRITICAL();
+	return res;
+}
+
+void sc_timeq_get_stats(sc_timeq_stats_t* p_stats){
+	taskENTER_CRITICAL();
+	*p_stats = stats;
+	taskEXIT_CRITICAL();
+}
+
+void sc_timeq_reset_stats(void){
+	taskENTER_CRITICAL();
+	stats.posted = 0;
+	stats.fired = 0;
+	stats.cancelled = 0;
+	stats.overflows = 0;
+	stats.late_max = 0;
+	stats.pending_max = heap_nb;
+	taskEXIT_CRITICAL();
+}
+
+void sc_timeq_print_stats(void){
+	sc_timeq_stats_t s;
+	sc_timeq_get_stats(&s);
+	xprintf("sc_timeq: posted=%u fired=%u cancelled=%u overflows=%u\n",
+			(unsigned int)s.posted,(unsigned int)s.fired,(unsigned int)s.cancelled,(unsigned int)s.overflows);
+	xprintf("sc_timeq: late max=%uus, pending max=%u/%d\n",(unsigned int)s.late_max,(unsigned int)s.pending_max,SC_TIMEQ_LEN);
+}
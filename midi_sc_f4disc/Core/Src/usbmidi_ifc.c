@@ -29,11 +29,12 @@
 #include "usbh_MIDI.h"
 #include "usb_host.h"
 #include "usbh_conf.h"
+#include "cyccnt.h"
+#include <string.h>
 
 #define MIDI_QUEUE_LEN		100
 #define EVENT_PACKET_SIZE	sizeof(T_usbmidi_EVENT_PACKET)		//in bytes
 #define TESTING				0
-#define WEAK_CB_INFO		0
 
 #if (TESTING != 0)
 	#define  TSTPRINT(...) {xprintf("TST: "); xprintf(__VA_ARGS__); printf("\n");}
@@ -41,30 +42,223 @@
 	#define TSTPRINT(...) do {} while (0)
 #endif
 
-#if (WEAK_CB_INFO != 0)
-	#define  WEAK_CB_PRINT(...) {xprintf("WEAK CALLBACK: "); xprintf(__VA_ARGS__); printf("\n");}
-#else
-	#define WEAK_CB_PRINT(...) do {} while (0)
-#endif
-
 
 const portTickType API_TX_TIMEOUT = 100;
 
-static QueueHandle_t midi_out_queue = NULL;
-static QueueHandle_t midi_in_queue = NULL;
+static QueueHandle_t midi_out_queue = NULL;	//the performance lane, see tx_lane_of
+static QueueHandle_t tx_rt_queue = NULL;	//the realtime lane
+static QueueHandle_t tx_bulk_queue = NULL;	//the bulk (SysEx) lane
+static TaskHandle_t tx_task_handle = NULL;
+static QueueHandle_t rx_free_queue = NULL;	//pointers to empty rx frames
+static QueueHandle_t rx_ready_queue = NULL;	//pointers to received rx frames, waiting for rx_task
 static SemaphoreHandle_t tx_busy = NULL;
+static SemaphoreHandle_t rx_lock = NULL;	//the subscriptions, see rx_lock_take
 //static void usbmidi_core_task(void* params);	//higher-level / API processing task
 static void rx_task(void *params); //a separate task to handle reception callbacks
 static void tx_task(void *params); //a separate task to handle reception callbacks
+static int tx_enqueue(T_usbmidi_EVENT_PACKET* marker, T_usbmidi_EVENT_PACKET* packets, uint16_t nb);
 static volatile uint8_t cable = 0;	//this is a bitmask, so don't write anything to its LSBs :P
 
 #define RX_BUFF_SIZE 64 /* USB MIDI buffer : max received data 64 bytes */
-uint8_t MIDI_RX_Buffer[RX_BUFF_SIZE]; // MIDI reception buffer
+#define RX_FRAMES_NB 8	/* number of rx frames in the pool */
+
+/*
+ * one USB-MIDI reception (bulk IN transfer)
+ * frames are passed between the USB host thread and rx_task by pointer
+ */
+typedef struct {
+	uint8_t data[RX_BUFF_SIZE] __attribute__((aligned(4)));
+	uint16_t len;
+	uint32_t stamp;		//arrival time [us] (usbmidi_cb_timestamp when the USB stack handed the frame over)
+} rx_frame_t;
+
+static rx_frame_t rx_frames[RX_FRAMES_NB];
+static rx_frame_t* rx_armed[2];	//the ping-pong pair owned by the class, re-armed after a reconnection
+static volatile uint8_t started = 0;
+static volatile usbmidi_rx_stats_t rx_stats;
+static uint32_t rx_stamp = 0;	//arrival time of the frame being parsed, see usbmidi_rx_timestamp
+
+/*
+ * note-in to CC-out latency probe
+ * a received note-on is followed until the transfer with the packets queued
+ * as its result completes (from the rx callback to the tx complete callback);
+ * only one note is followed at a time
+ */
+typedef enum {
+	LAT_IDLE = 0,
+	LAT_RXED,		//note-on dispatched, nothing queued yet
+	LAT_QUEUED,		//the response is in midi_out_queue
+	LAT_IN_FLIGHT	//the response is in the transfer being sent
+} lat_state_t;
+static volatile lat_state_t lat_state = LAT_IDLE;
+static volatile uint32_t lat_t0;
+static volatile usbmidi_lat_stats_t lat_stats;
+#define LAT_STALE_US	100000	//a note which hasn't produced any output by then is given up
+
+static int lat_can_start(void){
+	return (lat_state == LAT_IDLE) || ((usbmidi_cb_timestamp() - lat_t0) > LAT_STALE_US);
+}
+
+#define TX_BUFF_SIZE USB_MIDI_DATA_OUT_SIZE /* max data sent in one bulk OUT transfer */
+#define TX_BATCH_MAX (TX_BUFF_SIZE / EVENT_PACKET_SIZE)
+
+static volatile uint16_t tx_max_batch = TX_BATCH_MAX;	//1 = one packet per transfer (the old way), for benchmarking
+static volatile uint16_t tx_in_flight = 0;
+static volatile usbmidi_tx_stats_t tx_stats;
 
 extern ApplicationTypeDef Appli_state;
 extern USBH_HandleTypeDef hUsbHostHS;
 USBH_HandleTypeDef* phost = &hUsbHostHS;
 
+/*
+ * rx dispatch: a table indexed by CIN, each entry holds the handlers subscribed
+ * to that message class (see usbmidi_rx_subscribe); the SysEx CINs (0x04..0x07) are
+ * taken by rx_sysex_collect, which assembles whole messages for the SysEx subscribers
+ * handlers get the raw MIDI bytes (the status byte first) and their length
+ * rx_task dispatches a whole frame holding rx_lock, and a subscription is added or removed
+ * only with rx_lock taken, so the table never changes while it's being walked
+ */
+#define RX_SUBS_MAX		4
+
+typedef struct {
+	usbmidi_rx_handler_t handler;
+	void* ctx;
+	uint16_t ch;	//channels of the channel messages it wants, for the rx filter (see usbmidi_rx_set_channels)
+} rx_sub_t;
+
+typedef struct {
+	rx_sub_t subs[RX_SUBS_MAX];
+	volatile uint8_t nb;
+} rx_entry_t;
+
+static rx_entry_t rx_table[16];		//indexed by CIN
+static rx_entry_t rx_sysex_subs;	//whole SysEx messages
+static const uint8_t cin_len[16] = {0, 0, 2, 3, 3, 1, 2, 3, 3, 3, 3, 3, 2, 2, 3, 1};	//MIDI bytes in a packet
+
+static void rx_filter_update(void);
+
+static uint8_t sysex_rx[usbmidi_SYSEX_MAX_LEN];
+static int sysex_rx_idx;	//-1 = the message didn't fit, skipped until its end
+
+static void rx_dispatch(rx_entry_t* entry, const uint8_t* msg, uint16_t len){
+	uint8_t nb = entry->nb;
+	for(uint8_t i = 0; i < nb; i++){
+		entry->subs[i].handler(msg, len, entry->subs[i].ctx);
+	}
+}
+
+/*
+ * the only place where SysEx is assembled; ctx is the CIN
+ * CIN 0x04 continues the message, 0x05..0x07 end it
+ * (0x05 may also be a single-byte system common message, passed to the syscomm subscribers)
+ */
+static void rx_sysex_collect(const uint8_t* msg, uint16_t len, void* ctx){
+	uint8_t cin = (uint8_t)(uintptr_t)ctx;
+	if( (cin == CIN_SYSEX_END_COMM_1B) && (msg[0] != MIDI_STATUS_SYSEX_END) ){
+		rx_dispatch(&rx_table[CIN_SYS_COMM_2B], msg, len);
+		return;
+	}
+	if(msg[0] == MIDI_STATUS_SYSEX_START) sysex_rx_idx = 0;	//a new message, whatever happened to the previous one
+	if(sysex_rx_idx >= 0){
+		if(sysex_rx_idx + len <= usbmidi_SYSEX_MAX_LEN){
+			memcpy(&sysex_rx[sysex_rx_idx], msg, len);
+			sysex_rx_idx += len;
+		}
+		else{
+			USBH_ErrLog("usbmidi_ifc, rx_sysex_collect: message longer than %d bytes, skipped",usbmidi_SYSEX_MAX_LEN);
+			sysex_rx_idx = -1;
+		}
+	}
+	if(cin != CIN_SYSEX_ST_CNT){
+		if(sysex_rx_idx > 0) rx_dispatch(&rx_sysex_subs, sysex_rx, sysex_rx_idx);
+		sysex_rx_idx = 0;
+	}
+}
+
+/*
+ * decodes a single event packet and calls the subscribed handlers
+ */
+static void rx_packet(T_usbmidi_EVENT_PACKET* packet){
+	#if TESTING
+		xprintf("rxed some data: ");
+		debug_hexbuf(packet,sizeof(*packet));
+		xprintf("parsing...\n");
+	#endif
+	uint8_t cin = packet->cn_cin & 0x0F;	//ignore the Cable Number
+	rx_dispatch(&rx_table[cin], packet->midi, cin_len[cin]);
+}
+
+static int rx_entry_add(rx_entry_t* entry, usbmidi_rx_handler_t handler, void* ctx){
+	if(entry->nb >= RX_SUBS_MAX) return -1;
+	entry->subs[entry->nb].handler = handler;
+	entry->subs[entry->nb].ctx = ctx;
+	entry->subs[entry->nb].ch = 0xFFFF;
+	entry->nb++;
+	return 0;
+}
+
+static void rx_entry_remove(rx_entry_t* entry, usbmidi_rx_handler_t handler, void* ctx){
+	for(uint8_t i = 0; i < entry->nb; i++){
+		if( (entry->subs[i].handler == handler) && (entry->subs[i].ctx == ctx) ){
+			for(uint8_t j = i + 1; j < entry->nb; j++) entry->subs[j - 1] = entry->subs[j];
+			entry->nb--;
+			return;
+		}
+	}
+}
+
+//before the scheduler starts (or before usbmidi_init) there's no rx_task to wait for
+static void rx_lock_take(void){
+	if( (rx_lock != NULL) && (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) ) xSemaphoreTake(rx_lock, portMAX_DELAY);
+}
+
+static void rx_lock_give(void){
+	if( (rx_lock != NULL) && (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) ) xSemaphoreGive(rx_lock);
+}
+
+/*
+ * subscribes a handler to the message classes (USBMIDI_RX_* bits, may be or-ed)
+ * the handler is called from rx_task with the raw message; ctx is passed back as it is
+ * up to RX_SUBS_MAX handlers per class; can be called from any task, also before the scheduler starts,
+ * but not from a handler (it waits for rx_task to finish the frame being dispatched)
+ * the rx filter is rebuilt, so the new classes get through from the next frame on
+ * returns 0 on success, -1 if any of the classes is full (the handler is then subscribed to none)
+ */
+int usbmidi_rx_subscribe(uint16_t classes, usbmidi_rx_handler_t handler, void* ctx){
+	int res = 0;
+	if(handler == NULL) return -1;
+	classes &= USBMIDI_RX_ALL;
+	rx_lock_take();
+	vTaskSuspendAll();	//usbmidi_rx_set_channels doesn't take rx_lock
+	for(uint8_t cin = 0; cin < 16; cin++){
+		if(!(classes & (1 << cin))) continue;
+		rx_entry_t* entry = (cin == CIN_SYSEX_ST_CNT) ? &rx_sysex_subs : &rx_table[cin];
+		if(rx_entry_add(entry, handler, ctx) != 0) res = -1;
+	}
+	rx_filter_update();
+	xTaskResumeAll();
+	rx_lock_give();
+	if(res != 0){
+		usbmidi_rx_unsubscribe(handler, ctx);
+		USBH_ErrLog("usbmidi_rx_subscribe: too many handlers for classes %04X",classes);
+	}
+	return res;
+}
+
+//once it returns, the handler is not called anymore; not from a handler either
+void usbmidi_rx_unsubscribe(usbmidi_rx_handler_t handler, void* ctx){
+	rx_lock_take();
+	vTaskSuspendAll();
+	for(uint8_t cin = 0; cin < 16; cin++){
+		if( (cin >= CIN_SYSEX_ST_CNT) && (cin <= CIN_SYSEX_END_3B) ) continue;	//rx_sysex_collect stays
+		rx_entry_remove(&rx_table[cin], handler, ctx);
+	}
+	rx_entry_remove(&rx_sysex_subs, handler, ctx);
+	rx_filter_update();
+	xTaskResumeAll();
+	rx_lock_give();
+}
+
 /*
  * examples:
  * 09 90 24 64 09 90 36 64  09 90 3F 64 0B B1 50 6E
@@ -78,154 +272,559 @@ USBH_HandleTypeDef* phost = &hUsbHostHS;
  * this is a separate task so that user API callbacks can safely block
  * even for a longer time and the data will be queued without disrupting
  * the USB communication handled in the _hl_task
+ * it gets whole rx frames and gives them back to the pool once parsed
  */
 static void rx_task(void *params){
-
-	static uint8_t sysex_rx[usbmidi_SYSEX_MAX_LEN];
-	static int sysex_rx_idx;
-	static T_usbmidi_EVENT_PACKET packet;
+	rx_frame_t* frame;
 	TickType_t TIMEOUT = 100;
 
 	while(1){
 		//xprintf(".");
-		if( xQueueReceive(midi_in_queue, &packet, TIMEOUT) != pdPASS) continue;
-		#if TESTING
-			xprintf("rxed some data: ");
-			debug_hexbuf(&packet,sizeof(packet));
-			xprintf("parsing...\n");
-		#endif
-		uint8_t cin = packet.cn_cin & 0x0F;	//ignore the Cable Number
-		uint8_t ch = (packet.midi[0] & 0x0F) + 1;		//extract channel number (will be useful wherever applicable)
-
-		switch(cin){
-			case CIN_NOTE_ON:
-				usbmidi_cb_note_on(ch, packet.midi[1], packet.midi[2]);
-				break;
-			case CIN_NOTE_OFF:
-				usbmidi_cb_note_off(ch, packet.midi[1], packet.midi[2]);
-				break;
-			case CIN_SYSEX_ST_CNT:
-				if(sysex_rx_idx < (usbmidi_SYSEX_MAX_LEN-4)){
-					sysex_rx[sysex_rx_idx++] = packet.midi[0];
-					sysex_rx[sysex_rx_idx++] = packet.midi[1];
-					sysex_rx[sysex_rx_idx++] = packet.midi[2];
-				}
-				else{
-					USBH_ErrLog("usbmidi_ifc, process_rx, SYSEX_ST_CNT, sysex_rx_idx out of range");
-				}
-				break;
-			case CIN_SYSEX_END_3B:
-				if(sysex_rx_idx < (usbmidi_SYSEX_MAX_LEN-4)){
-					sysex_rx[sysex_rx_idx++] = packet.midi[0];
-					sysex_rx[sysex_rx_idx++] = packet.midi[1];
-					sysex_rx[sysex_rx_idx++] = packet.midi[2];
-					usbmidi_cb_sysex(sysex_rx, sysex_rx_idx);
-					sysex_rx_idx = 0;
-				}
-				else{
-					USBH_ErrLog("usbmidi_ifc, process_rx, SYSEX_END_3B, sysex_rx_idx out of range");
-				}
-				break;
-			case CIN_SYSEX_END_2B:
-				if(sysex_rx_idx < (usbmidi_SYSEX_MAX_LEN-3)){
-					sysex_rx[sysex_rx_idx++] = packet.midi[0];
-					sysex_rx[sysex_rx_idx++] = packet.midi[1];
-					usbmidi_cb_sysex(sysex_rx, sysex_rx_idx);
-					sysex_rx_idx = 0;
-				}
-				else{
-					USBH_ErrLog("usbmidi_ifc, process_rx, SYSEX_END_2B, sysex_rx_idx out of range");
-				}
-				break;
-		case CIN_SYSEX_END_COMM_1B:
-			if(packet.midi[0] != MIDI_STATUS_SYSEX_END){
-				usbmidi_cb_syscomm(packet.midi[0], packet.midi[1], packet.midi[2]);
-			}	//if(packet.midi[0] != MIDI_STATUS_SYSEX_END){
-			else{
-				if(sysex_rx_idx < (usbmidi_SYSEX_MAX_LEN-2)){
-					sysex_rx[sysex_rx_idx++] = packet.midi[0];
-					usbmidi_cb_sysex(sysex_rx, sysex_rx_idx);
-					sysex_rx_idx = 0;
-				} //if(sysex_rx_idx < (usbmidi_SYSEX_MAX_LEN-2)){
-				else{
-					USBH_ErrLog("usbmidi_ifc, process_rx, SYSEX_END_COMM_1B, sysex_rx_idx out of range");
-				}	//else/if(sysex_rx_idx < (usbmidi_SYSEX_MAX_LEN-2)){
-			}	//else/if(packet.midi[0] != MIDI_STATUS_SYSEX_END){
-			break;
-		case CIN_CC:
-			usbmidi_cb_cc(ch, packet.midi[1], packet.midi[2]);
-			break;
-		case CIN_PC:
-			usbmidi_cb_pc(ch, packet.midi[1]);
-			break;
-		case CIN_PITCH_BEND:
-			usbmidi_cb_pitchbend(ch, packet.midi[1], packet.midi[2]);
-			break;
-		case CIN_CHAN_PRESSURE:
-			usbmidi_cb_aftertouch(packet.midi[0], packet.midi[1], packet.midi[2]);
-			break;
-		case CIN_SYS_COMM_2B:	//2-byte system common, e.g. time code, SongSelect
-			usbmidi_cb_syscomm(packet.midi[0], packet.midi[1], packet.midi[2]);
-			break;
-		case CIN_SYS_COMM_3B:	//3-byte system common, e.g. song pos
-			usbmidi_cb_syscomm(packet.midi[0], packet.midi[1], packet.midi[2]);
-			break;
-		case CIN_SINGLE_BYTE:
-			usbmidi_cb_byte(packet.midi[0]);
-			break;
-		default:
-			USBH_ErrLog("usbmidi_ifc, process_rx, default, unsupported CIN=%X",cin);
-			break;
-		}//switch
+		if( xQueueReceive(rx_ready_queue, &frame, TIMEOUT) != pdPASS) continue;
+		uint16_t data_len = frame->len;
+		if(data_len & 0x03){
+			USBH_ErrLog("usbmidi_ifc, rx_task: unaligned length of %d. Will truncate.\n",(unsigned int)data_len);
+			data_len = data_len & ((uint16_t)(~0x3));
+		}
+		T_usbmidi_EVENT_PACKET* packet = (T_usbmidi_EVENT_PACKET*)frame->data;
+		int packets_nb = data_len / EVENT_PACKET_SIZE;
+		uint32_t wait = usbmidi_cb_timestamp() - frame->stamp;
+		if(wait > rx_stats.wait_max_us) rx_stats.wait_max_us = wait;
+		rx_stamp = frame->stamp;
+		xSemaphoreTake(rx_lock, portMAX_DELAY);	//the subscriptions stay as they are for the whole frame
+		for( int packet_idx = 0; packet_idx < packets_nb; packet_idx++){
+			if( ((packet[packet_idx].cn_cin & 0x0F) == CIN_NOTE_ON) && lat_can_start() ){
+				lat_t0 = frame->stamp;
+				lat_state = LAT_RXED;
+			}
+			rx_packet(&packet[packet_idx]);
+		}
+		xSemaphoreGive(rx_lock);
+		rx_stats.packets += packets_nb;
+		xQueueSend(rx_free_queue, &frame, 0);	//can't fail, the queue holds all the frames
 	}//while(1)
 }
 
+/*
+ * output lanes, served by tx_task with strict priority:
+ * realtime (single bytes 0xF8..0xFF: clock, start/stop...) - performance (everything else:
+ * notes, CCs, frame-tagged batches and the reserved tokens below) - bulk (SysEx)
+ * the lane is picked for every transfer only when the previous one is done, and bulk goes out
+ * in chunks of at most one transfer (TX_BULK_CHUNK packets, one max size bulk packet),
+ * so a SysEx dump delays a realtime or performance message by one chunk at most,
+ * which leaves within a USB frame
+ */
+#define TX_RT_QUEUE_LEN		16
+#define TX_BULK_QUEUE_LEN	48
+#define TX_BULK_CHUNK		TX_BATCH_MAX
+
+static QueueHandle_t tx_lane_of(const T_usbmidi_EVENT_PACKET* packet){
+	uint8_t cin = packet->cn_cin & 0x0F;
+	uint8_t status = packet->midi[0];
+	if( ((cin == CIN_SINGLE_BYTE) || (cin == CIN_SYSEX_END_COMM_1B)) && (status >= MIDI_STATUS_TIMING_CLOCK) ){
+		return tx_rt_queue;
+	}
+	if( (cin == CIN_SYSEX_ST_CNT) || (cin == CIN_SYSEX_END_2B) || (cin == CIN_SYSEX_END_3B) ||
+			((cin == CIN_SYSEX_END_COMM_1B) && (status == MIDI_STATUS_SYSEX_END)) ){
+		return tx_bulk_queue;
+	}
+	return midi_out_queue;
+}
+
+static int tx_pending(void){
+	return uxQueueMessagesWaiting(tx_rt_queue) || uxQueueMessagesWaiting(midi_out_queue) ||
+			uxQueueMessagesWaiting(tx_bulk_queue);
+}
+
+//to be called after queueing anything, tx_task sleeps until then
+static void tx_wake(void){
+	if(tx_task_handle != NULL) xTaskNotifyGive(tx_task_handle);
+}
+
+/*
+ * frame-tagged batches (usbmidi_tx_events_at) are preceded in midi_out_queue
+ * by a marker packet; CIN 0 is reserved by the USB MIDI spec,
+ * so the marker never collides with the real traffic
+ * marker: midi[0..1] = target frame (lower 16 bits), midi[2] = packets in the batch
+ */
+#define TX_MARKER_CN_CIN	0xF0
+
+/*
+ * CC coalescing: a CC waits in midi_out_queue as a slot token (again a reserved CIN 0
+ * packet, midi[0] = slot index) while its value is kept in the slot; a newer CC with the
+ * same cable/channel/controller queued before tx_task takes the token just replaces
+ * the value, so under backpressure the queue holds at most one CC per controller and
+ * the one that goes out is always the latest; everything else stays in strict order
+ */
+#define TX_SLOT_CN_CIN		0xE0
+#define TX_SLOTS_NB			32
+#define TX_SLOT_FREE		0xFFFF
+#define TX_CC_KEY(p)		((uint16_t)((((p)->cn_cin & 0xF0) << 7) | (((p)->midi[0] & 0x0F) << 7) | ((p)->midi[1] & 0x7F)))
+
+static T_usbmidi_EVENT_PACKET tx_slot[TX_SLOTS_NB];
+static uint16_t tx_slot_key[TX_SLOTS_NB] = {[0 ... TX_SLOTS_NB - 1] = TX_SLOT_FREE};
+static volatile uint8_t tx_coalesce = 1;	//0 = every CC is sent, for benchmarking
+
+/*
+ * CC shadow: the last value queued for every channel/controller, CC_SHADOW_NONE if nothing
+ * has been sent yet (or if it was lost in a dropped transfer, see tx_shadow_forget); a CC with the same value as its shadow is skipped, and after the device
+ * is reconnected all of them are sent again (see tx_resync), so the device gets back
+ * to the state the sidechain left it in, even if the last CCs were lost with the old connection
+ * the output goes to one cable at a time, so the cable isn't a part of the key
+ */
+#define CC_SHADOW_NONE		0xFF
+#define TX_RESYNC_CN_CIN	0xD0	//reserved CIN 0 again: "send the whole shadow now"
+
+static uint8_t cc_shadow[16][128];	//2KB
+
+//the pending slot of the packet's controller, -1 if there's none
+static int tx_slot_find(T_usbmidi_EVENT_PACKET* packet){
+	uint16_t key = TX_CC_KEY(packet);
+	for(int i = 0; i < TX_SLOTS_NB; i++){
+		if(tx_slot_key[i] == key) return i;
+	}
+	return -1;
+}
+
+static int tx_slot_alloc(T_usbmidi_EVENT_PACKET* packet){
+	for(int i = 0; i < TX_SLOTS_NB; i++){
+		if(tx_slot_key[i] == TX_SLOT_FREE){
+			tx_slot_key[i] = TX_CC_KEY(packet);
+			tx_slot[i] = *packet;
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * the packet as it goes to midi_out_queue: a CC becomes a slot token
+ * (or stays as it is if all the slots are taken)
+ * returns 0 if it only updated the value of a waiting CC or if the CC doesn't change anything
+ * (same value as in cc_shadow), nothing is to be queued
+ * producers only, with the scheduler suspended (see tx_enqueue)
+ */
+static int tx_coalesce_packet(T_usbmidi_EVENT_PACKET* packet, T_usbmidi_EVENT_PACKET* out){
+	*out = *packet;
+	if( !tx_coalesce || ((packet->cn_cin & 0x0F) != CIN_CC) ) return 1;
+	uint8_t* shadow = &cc_shadow[packet->midi[0] & 0x0F][packet->midi[1] & 0x7F];
+	if(*shadow == packet->midi[2]){
+		tx_stats.deduped++;
+		return 0;
+	}
+	*shadow = packet->midi[2];
+	int slot = tx_slot_find(packet);
+	if(slot >= 0){
+		tx_slot[slot] = *packet;
+		tx_stats.superseded++;
+		return 0;
+	}
+	slot = tx_slot_alloc(packet);
+	if(slot >= 0){
+		out->cn_cin = TX_SLOT_CN_CIN;
+		out->midi[0] = (uint8_t)slot;
+		out->midi[1] = 0;
+		out->midi[2] = 0;
+	}
+	return 1;
+}
+
+/*
+ * the CCs of a transfer that was dropped never reached the device, so their shadow
+ * no longer tells what the device has: these entries are forgotten, the next CC
+ * for them goes out whatever its value, and a resync doesn't restore a value that wasn't sent
+ * an entry a producer has changed since is left alone, its new value is still queued
+ */
+static void tx_shadow_forget(T_usbmidi_EVENT_PACKET* buf, uint16_t packets_nb){
+	vTaskSuspendAll();	//producers update the shadow with the scheduler suspended (see tx_enqueue)
+	for(uint16_t i = 0; i < packets_nb; i++){
+		if( (buf[i].cn_cin & 0x0F) != CIN_CC ) continue;
+		uint8_t* shadow = &cc_shadow[buf[i].midi[0] & 0x0F][buf[i].midi[1] & 0x7F];
+		if(*shadow == buf[i].midi[2]) *shadow = CC_SHADOW_NONE;
+	}
+	xTaskResumeAll();
+}
+
+//replaces a slot token taken from midi_out_queue with the CC it stands for
+static void tx_slot_take(T_usbmidi_EVENT_PACKET* packet){
+	if(packet->cn_cin != TX_SLOT_CN_CIN) return;
+	uint8_t slot = packet->midi[0];
+	taskENTER_CRITICAL();	//a producer must not update the slot while it's being freed
+	*packet = tx_slot[slot];
+	tx_slot_key[slot] = TX_SLOT_FREE;
+	taskEXIT_CRITICAL();
+}
+
+static uint32_t tx_marker_frame(T_usbmidi_EVENT_PACKET* marker){
+	uint32_t now = USBH_MIDI_GetFrame(phost);
+	uint16_t frame16 = ((uint16_t)marker->midi[0] << 8) | marker->midi[1];
+	return now + (int16_t)(frame16 - (uint16_t)now);
+}
+
+//packets in one transfer: up to the OUT endpoint size, but no more than tx_max_batch
+static uint16_t tx_limit(void){
+	uint16_t limit = USBH_MIDI_GetMaxTxSize(phost) / EVENT_PACKET_SIZE;
+	if((limit == 0) || (limit > TX_BATCH_MAX)) limit = TX_BATCH_MAX;
+	if(limit > tx_max_batch) limit = tx_max_batch;
+	return limit;
+}
+
+/*
+ * collects as many packets queued in the lane as possible into one staging buffer, up to limit
+ * a frame-tagged batch always goes in its own transfer, so filling stops at its marker
+ * (and at a resync request, which is handled by tx_task on its own)
+ * returns the number of packets in the buffer
+ */
+static uint16_t tx_fill(T_usbmidi_EVENT_PACKET* buf, uint16_t packets_nb, QueueHandle_t lane, uint16_t limit){
+	T_usbmidi_EVENT_PACKET next;
+	while( (packets_nb < limit) && (xQueuePeek(lane, &next, 0) == pdPASS) ){
+		if( (next.cn_cin == TX_MARKER_CN_CIN) || (next.cn_cin == TX_RESYNC_CN_CIN) ) break;
+		xQueueReceive(lane, &buf[packets_nb], 0);	//tx_task is the only reader, can't fail after the peek
+		tx_slot_take(&buf[packets_nb]);
+		packets_nb++;
+	}
+	return packets_nb;
+}
+
+/*
+ * sends every CC from cc_shadow again, in as few bulk transfers as possible
+ * (one full staging buffer each), alternating the staging buffers like tx_task does
+ * returns the staging buffer to fill next
+ */
+static uint8_t tx_resync(T_usbmidi_EVENT_PACKET tx_buf[2][TX_BATCH_MAX], uint8_t fill_idx, TickType_t timeout){
+	uint16_t limit = tx_limit();
+	uint16_t packets_nb = 0;
+	for(int idx = 0; idx <= 16 * 128; idx++){
+		T_usbmidi_EVENT_PACKET* buf = tx_buf[fill_idx];
+		if(idx < 16 * 128){
+			uint8_t ch = idx >> 7;
+			uint8_t ctrl = idx & 0x7F;
+			uint8_t value = cc_shadow[ch][ctrl];
+			if(value == CC_SHADOW_NONE) continue;
+			buf[packets_nb].cn_cin = cable | CIN_CC;
+			buf[packets_nb].midi[0] = MIDI_STATUS_CONTROL_CHANGE | ch;
+			buf[packets_nb].midi[1] = ctrl;
+			buf[packets_nb].midi[2] = value;
+			packets_nb++;
+			if(packets_nb < limit) continue;
+		}
+		if(packets_nb == 0) break;
+		if( xSemaphoreTake(tx_busy,timeout) != pdTRUE ){
+			tx_stats.dropped += packets_nb;
+			USBH_ErrLog("usbmidi_ifc, tx_resync: could not get tx_busy semphr");
+			tx_shadow_forget(buf, packets_nb);
+			vTaskSuspendAll();	//nothing after this batch is sent either
+			for(idx++; idx < 16 * 128; idx++) cc_shadow[idx >> 7][idx & 0x7F] = CC_SHADOW_NONE;
+			xTaskResumeAll();
+			break;
+		}
+		tx_stats.packets += packets_nb;
+		tx_stats.transfers++;
+		tx_stats.resynced += packets_nb;
+		tx_in_flight = packets_nb;
+		USBH_MIDI_Transmit(phost,(uint8_t*)buf,packets_nb * EVENT_PACKET_SIZE);
+		fill_idx ^= 1;
+		packets_nb = 0;
+	}
+	return fill_idx;
+}
+
+/*
+ * puts what's waiting in the lane in front of the packets already in the buffer,
+ * as much as there's room for; the rest leads the next transfer
+ * returns the number of packets in the buffer
+ */
+static uint16_t tx_prepend(T_usbmidi_EVENT_PACKET* buf, uint16_t packets_nb, QueueHandle_t lane, uint16_t limit){
+	uint16_t nb = uxQueueMessagesWaiting(lane);
+	if(nb > limit - packets_nb) nb = limit - packets_nb;
+	if(nb == 0) return packets_nb;
+	memmove(&buf[nb], buf, packets_nb * EVENT_PACKET_SIZE);
+	return packets_nb + tx_fill(buf, 0, lane, nb);	//tx_task is the only reader, all nb are there
+}
+
+/*
+ * aggregating TX with two staging buffers:
+ * the next transfer is filled in one buffer while the previous one is still in flight
+ * from the other, so everything that is queued by the time it completes goes out
+ * in the next bulk transfer, and a batch queued with usbmidi_tx_events()
+ * leaves in a single USB frame
+ * lanes: realtime first, topped up with performance; bulk only when both are empty,
+ * one chunk per transfer; once the previous transfer is done, the buffer is topped up
+ * with what came in while it was waiting: realtime in front, performance at the end
+ * frame-tagged batches are handed over to the class with their target frame
+ * and submitted at the start of that frame (released by the SOF interrupt, sent by the
+ * USB host thread); such a transfer holds the pipe until then, so it's never committed
+ * while realtime is waiting: the batch is held in its buffer, the realtime goes out from
+ * the other one, and the batch follows (late, if it has to - the class then sends it
+ * at the next SOF); while a batch is held there's no free buffer to fill ahead
+ */
 static void tx_task(void* params){
-	static T_usbmidi_EVENT_PACKET packet;
+	static T_usbmidi_EVENT_PACKET tx_buf[2][TX_BATCH_MAX];	//the one being filled, the one in flight (or held)
+	uint8_t fill_idx = 0;
+	uint16_t held_nb = 0;	//packets of the frame-tagged batch held in tx_buf[held_idx]
+	uint8_t held_idx = 0;
+	uint32_t held_frame = 0;
 	const TickType_t TIMEOUT = 100;
 
 	while(1){
 		//xprintf("*");
-		if( xQueueReceive(midi_out_queue, &packet, TIMEOUT) ){
-			TSTPRINT("rxed something on midi_out_queue");
-			if( xSemaphoreTake(tx_busy,TIMEOUT) == pdTRUE ){	//take the semaphore - will be released @ tx end callback
-				TSTPRINT("tx semphr obtained\n");
-				USBH_MIDI_Transmit(phost,(uint8_t*)&packet,4);
+		T_usbmidi_EVENT_PACKET* buf = tx_buf[fill_idx];
+		if(!tx_pending() && !held_nb){
+			ulTaskNotifyTake(pdTRUE, TIMEOUT);	//see tx_wake
+			continue;
+		}
+		uint16_t limit = tx_limit();
+		uint16_t packets_nb = 0;
+		uint8_t timed = 0;
+		uint8_t bulk = 0;
+		uint32_t frame = 0;
+		T_usbmidi_EVENT_PACKET next;
+
+		if(!held_nb){
+			//the previous transfer may still be in flight, from the other buffer
+			packets_nb = tx_fill(buf, 0, tx_rt_queue, limit);
+			tx_stats.realtime += packets_nb;
+			if( (packets_nb == 0) && (xQueuePeek(midi_out_queue, &next, 0) == pdPASS) &&
+					((next.cn_cin == TX_MARKER_CN_CIN) || (next.cn_cin == TX_RESYNC_CN_CIN)) ){
+				xQueueReceive(midi_out_queue, &next, 0);
+				if(next.cn_cin == TX_RESYNC_CN_CIN){
+					fill_idx = tx_resync(tx_buf, fill_idx, TIMEOUT);	//it fills ahead the same way
+					continue;
+				}
+				uint16_t batch_nb = next.midi[2];
+				timed = 1;
+				frame = tx_marker_frame(&next);
+				while( (packets_nb < batch_nb) && (xQueueReceive(midi_out_queue, &buf[packets_nb], 0) == pdPASS) ){
+					tx_slot_take(&buf[packets_nb]);
+					packets_nb++;
+				}
 			}
 			else{
-				USBH_ErrLog("usbmidi_ifc, process_tx: could not get tx_busy semphr");
-			}//else / if( xQueueReceive(midi_out_queue
-		}//if( xQueueReceive(midi_out_queue
+				packets_nb = tx_fill(buf, packets_nb, midi_out_queue, limit);	//stops at a marker, it goes in the next transfer
+			}
+			if( (packets_nb == 0) && !timed ){
+				packets_nb = tx_fill(buf, 0, tx_bulk_queue, (limit < TX_BULK_CHUNK) ? limit : TX_BULK_CHUNK);
+				tx_stats.bulk += packets_nb;
+				bulk = 1;
+			}
+			if(packets_nb == 0) continue;
+		}
+
+		uint8_t busy_taken = (xSemaphoreTake(tx_busy,TIMEOUT) == pdTRUE);	//will be released @ tx end callback
+		//the previous transfer is done, both buffers are free (but the held one)
+		if(held_nb){
+			buf = tx_buf[held_idx ^ 1];
+			packets_nb = tx_fill(buf, 0, tx_rt_queue, limit);
+			tx_stats.realtime += packets_nb;
+			if(packets_nb == 0){	//the realtime is out, the held batch goes now
+				buf = tx_buf[held_idx];
+				packets_nb = held_nb;
+				frame = held_frame;
+				timed = 1;
+				held_nb = 0;
+			}
+			//else the held batch still waits, and the performance lane behind it too
+		}
+		else if(timed){
+			if(uxQueueMessagesWaiting(tx_rt_queue)){	//realtime came in while the batch was waiting
+				held_idx = fill_idx;
+				held_nb = packets_nb;
+				held_frame = frame;
+				timed = 0;
+				buf = tx_buf[fill_idx ^ 1];
+				packets_nb = tx_fill(buf, 0, tx_rt_queue, limit);
+				tx_stats.realtime += packets_nb;
+			}
+		}
+		else{	//topped up with what came in while the buffer was waiting
+			uint16_t filled = packets_nb;
+			packets_nb = tx_prepend(buf, packets_nb, tx_rt_queue, limit);
+			tx_stats.realtime += packets_nb - filled;
+			if(!bulk) packets_nb = tx_fill(buf, packets_nb, midi_out_queue, limit);
+		}
+		fill_idx = (buf == tx_buf[0]) ? 0 : 1;
+
+		if(packets_nb == 0){
+			if(busy_taken) xSemaphoreGive(tx_busy);
+			continue;
+		}
+		if(!busy_taken){
+			tx_stats.dropped += packets_nb;
+			USBH_ErrLog("usbmidi_ifc, process_tx: could not get tx_busy semphr");
+			tx_shadow_forget(buf, packets_nb);
+			continue;	//the buffer is filled again, it was never handed over
+		}
+		TSTPRINT("tx semphr obtained\n");
+		tx_stats.packets += packets_nb;
+		tx_stats.transfers++;
+		tx_in_flight = packets_nb;
+		if( (lat_state == LAT_QUEUED) && !tx_pending() && !held_nb ) lat_state = LAT_IN_FLIGHT;
+		if(timed){
+			tx_stats.timed++;
+			USBH_MIDI_TransmitAtFrame(phost,(uint8_t*)buf,packets_nb * EVENT_PACKET_SIZE,frame);
+		}
+		else{
+			USBH_MIDI_Transmit(phost,(uint8_t*)buf,packets_nb * EVENT_PACKET_SIZE);
+		}
+		fill_idx ^= 1;	//the next one is filled while this one is in flight
+	}
+}
+
+/*
+ * the rx pre-filter: whatever no handler is subscribed to (notes on unrelated channels,
+ * aftertouch...) is dropped right in the USB callback, before it costs a frame from the pool,
+ * a queue copy and a switch to rx_task
+ * it's the union of the subscriptions, rebuilt by rx_filter_update whenever they change;
+ * SysEx and the realtime bytes (0xF8..0xFF) always pass
+ * double buffered: rx_filter_update writes the copy which isn't in use
+ * and switches the pointer, the USB callback only reads through the pointer
+ */
+typedef struct {
+	uint16_t cin[16];	//a bit per channel (bit 0 = channel 1) for the channel messages (CIN 0x08..0x0E);
+						//for the other CINs 0 drops and anything else lets through
+	uint16_t sys;		//system messages (CIN 0x02, 0x03 and single bytes 0xF0..0xFF) by status, bit n = 0xFn
+} rx_filter_t;
+
+#define RX_FILTER_REALTIME	0xFF00
+
+static const rx_filter_t rx_filter_all = {{[0 ... 15] = 0xFFFF}, 0xFFFF};
+static rx_filter_t rx_filters[2];
+static const rx_filter_t* volatile rx_filter = &rx_filter_all;
+
+/*
+ * a program change may move the inputs to other channels, and until the new subscriptions
+ * are in (usbmidi_rx_set_channels from the consumer) the filter would drop what comes on them,
+ * e.g. a trigger sent right after the PC: so after a PC everything passes, until the next
+ * rx_filter_update or for RX_FILTER_OPEN_US at most (a PC nobody acts upon)
+ */
+#define RX_FILTER_OPEN_US	100000
+static volatile uint8_t rx_filter_open = 0;
+static uint32_t rx_filter_open_t0;
+
+//with the scheduler suspended, like every change of the subscriptions
+//(which also means that rx_task isn't in the middle of adding or removing one)
+static void rx_filter_update(void){
+	rx_filter_t* f = (rx_filter == &rx_filters[0]) ? &rx_filters[1] : &rx_filters[0];
+	memset(f, 0, sizeof(*f));
+	for(uint8_t cin = 0; cin < 16; cin++){
+		for(uint8_t i = 0; i < rx_table[cin].nb; i++) f->cin[cin] |= rx_table[cin].subs[i].ch;
+	}
+	for(uint8_t cin = CIN_SYSEX_ST_CNT; cin <= CIN_SYSEX_END_3B; cin++) f->cin[cin] = 0xFFFF;
+	f->sys = RX_FILTER_REALTIME;
+	if(f->cin[CIN_SYS_COMM_2B] || f->cin[CIN_SYS_COMM_3B] || f->cin[CIN_SINGLE_BYTE]) f->sys = 0xFFFF;
+	__DMB();	//the filter must be complete before it's published
+	rx_filter = f;
+	rx_filter_open = 0;
+}
+
+/*
+ * narrows the channel messages (notes, CC, PC...) the handler is subscribed to
+ * down to the given channels (bit 0 = channel 1), 0xFFFF = all of them (the default)
+ * it's a hint for the rx filter only: the handler still gets the other channels
+ * if another handler of the same class wants them, so it should check the channel anyway
+ * never blocks, can be called from the engine
+ */
+void usbmidi_rx_set_channels(usbmidi_rx_handler_t handler, void* ctx, uint16_t channels){
+	vTaskSuspendAll();
+	for(uint8_t cin = CIN_NOTE_OFF; cin <= CIN_PITCH_BEND; cin++){
+		rx_entry_t* entry = &rx_table[cin];
+		for(uint8_t i = 0; i < entry->nb; i++){
+			if( (entry->subs[i].handler == handler) && (entry->subs[i].ctx == ctx) ) entry->subs[i].ch = channels;
+		}
+	}
+	rx_filter_update();
+	xTaskResumeAll();
+}
+
+static int rx_filter_pass(const rx_filter_t* f, const T_usbmidi_EVENT_PACKET* packet){
+	uint8_t cin = packet->cn_cin & 0x0F;
+	uint8_t status = packet->midi[0];
+	if( (cin >= CIN_NOTE_OFF) && (cin <= CIN_PITCH_BEND) ){
+		return (f->cin[cin] >> (status & 0x0F)) & 1;
+	}
+	if( ((cin == CIN_SYS_COMM_2B) || (cin == CIN_SYS_COMM_3B) || (cin == CIN_SINGLE_BYTE)) && (status >= 0xF0) ){
+		return (f->sys >> (status & 0x0F)) & 1;
 	}
+	return f->cin[cin] != 0;
 }
 
+/*
+ * compacts the packets which pass the filter at the start of the frame
+ * returns the new data length, 0 if nothing is left
+ */
+static uint16_t rx_filter_frame(rx_frame_t* frame, uint16_t data_len, uint32_t stamp){
+	const rx_filter_t* f = rx_filter;
+	T_usbmidi_EVENT_PACKET* packet = (T_usbmidi_EVENT_PACKET*)frame->data;
+	uint16_t packets_nb = data_len / EVENT_PACKET_SIZE;
+	uint16_t kept = 0;
+	if( rx_filter_open && ((stamp - rx_filter_open_t0) > RX_FILTER_OPEN_US) ) rx_filter_open = 0;
+	if( (f == &rx_filter_all) || rx_filter_open ) return data_len;
+	for(uint16_t i = 0; i < packets_nb; i++){
+		if(rx_filter_open || rx_filter_pass(f, &packet[i])){
+			if(kept != i) packet[kept] = packet[i];
+			kept++;
+			if( ((packet[kept - 1].cn_cin & 0x0F) == CIN_PC) && !rx_filter_open ){
+				rx_filter_open_t0 = stamp;
+				rx_filter_open = 1;
+			}
+		}
+	}
+	rx_stats.filtered += packets_nb - kept;
+	rx_stats.forwarded += kept;
+	return kept * EVENT_PACKET_SIZE;
+}
+
+/*
+ * runs on the USB host thread, so it must never block:
+ * it only re-arms the reception into a free frame and passes the received one
+ * to rx_task by pointer; all the parsing is done by rx_task
+ * if the pool is exhausted, the just received frame is reused (and lost),
+ * but the reception is re-armed anyway
+ */
 void USBH_MIDI_ReceiveCallback(USBH_HandleTypeDef *phost){
+	//the class is already receiving into the other frame (ping-pong), "done" is ours now
 	uint16_t data_len = USBH_MIDI_GetLastReceivedDataSize(phost);
+	rx_frame_t* done = (rx_frame_t*)USBH_MIDI_GetLastReceivedData(phost);	//data is the first member
+	rx_frame_t* next = NULL;
+	uint32_t stamp = usbmidi_cb_timestamp();
 	TSTPRINT("usbmidi_ifc: rxed data len=%02d:\n",data_len);
-	if(data_len < 4) {
-		USBH_ErrLog("USBH_MIDI_ReceiveCallback: data_len < 4 (%d). Ignoring.\n",(unsigned int)data_len);
-		return;
+
+	if(data_len >= EVENT_PACKET_SIZE){
+		data_len = rx_filter_frame(done, data_len, stamp);
 	}
-	if(data_len & 0x03){
-		USBH_ErrLog("USBH_MIDI_ReceiveCallback: unaligned length of %d. Will truncate.\n",(unsigned int)data_len);
-		data_len = data_len & ((uint16_t)(~0x3));
+	if(data_len < EVENT_PACKET_SIZE){
+		//nothing useful inside (or all filtered out), queue the same frame again
+		next = done;
 	}
-	T_usbmidi_EVENT_PACKET* packet = (T_usbmidi_EVENT_PACKET*)MIDI_RX_Buffer;
-	int packets_nb = data_len / 4;
-
-	for( int packet_idx = 0; packet_idx < packets_nb; packet_idx++){
-		const TickType_t TIMEOUT = 100;
-		//put data into queue - they will be rxed in the rx_process function
-		if(xQueueSend(midi_in_queue,&packet[packet_idx],TIMEOUT) != pdPASS){
-			USBH_ErrLog("USBH_MIDI_ReceiveCallback: could not send a packet to midi_in_queue.\n");
-		}
+	else if(xQueueReceive(rx_free_queue, &next, 0) != pdPASS){
+		next = done;
+		rx_stats.overflows++;
 	}
 
-	USBH_MIDI_Receive(phost, MIDI_RX_Buffer, RX_BUFF_SIZE); // start a new reception
+	USBH_MIDI_ReceiveNext(phost, next->data, RX_BUFF_SIZE); // queue the reception after the current one
+	if(rx_armed[0] == done) rx_armed[0] = next;
+	else rx_armed[1] = next;
+
+	if(next != done){
+		done->len = data_len;
+		done->stamp = stamp;
+		xQueueSend(rx_ready_queue, &done, 0);	//can't fail, the queue holds all the frames
+		rx_stats.frames++;
+	}
 }
 
 void USBH_MIDI_TransmitCallback(USBH_HandleTypeDef *phost){
 	TSTPRINT("USB MIDI TX Cplt\n");
+	tx_stats.done += tx_in_flight;
+	tx_in_flight = 0;
+	if(lat_state == LAT_IN_FLIGHT){
+		uint32_t lat = usbmidi_cb_timestamp() - lat_t0;
+		lat_stats.count++;
+		lat_stats.last_us = lat;
+		lat_stats.sum_us += lat;
+		if(lat > lat_stats.max_us) lat_stats.max_us = lat;
+		lat_state = LAT_IDLE;
+	}
 	xSemaphoreGive(tx_busy);
 }
 
@@ -243,13 +842,103 @@ int usbmidi_tx_event(T_usbmidi_EVENT_PACKET* packet){
 	xprintf("0x%02X, 0x%02X, 0x%02X, 0x%02X, ",packet->cn_cin,packet->midi[0],packet->midi[1],packet->midi[2]);
 #endif
 
-	if( xQueueSend(midi_out_queue,packet,API_TX_TIMEOUT) != pdTRUE ){
-		USBH_ErrLog("usbmidi_tx_event: could not send to midi_out_queue");
+	if( (packet->cn_cin & 0x0F) == CIN_CC ){
+		return tx_enqueue(NULL, packet, 1);		//coalesced
+	}
+	if( xQueueSend(tx_lane_of(packet),packet,API_TX_TIMEOUT) != pdTRUE ){
+		USBH_ErrLog("usbmidi_tx_event: could not send to the tx lane");
 		return -1;
 	}
 	else{
 		TSTPRINT("usbmidi_tx_event: data sent to Queue");
 	}
+	tx_wake();
+	return 0;
+}
+
+/*
+ * queues a batch of packets as one unit - nothing else gets in between
+ * the tx_task will then send the whole batch in one bulk transfer
+ * (as long as it fits into TX_BUFF_SIZE)
+ * a CC whose controller is still waiting in the queue only updates the waiting value
+ * (see tx_slot_take), so the batch may get shorter
+ * returns 0 if all the packets have been added to the TX queue
+ * returns -1 if there was no room for the batch within API_TX_TIMEOUT
+ */
+static int tx_enqueue(T_usbmidi_EVENT_PACKET* marker, T_usbmidi_EVENT_PACKET* packets, uint16_t nb){
+	TickType_t waited = 0;
+	UBaseType_t needed = nb + ((marker != NULL) ? 1 : 0);
+	while(1){
+		vTaskSuspendAll();
+		if(uxQueueSpacesAvailable(midi_out_queue) >= needed){
+			T_usbmidi_EVENT_PACKET out;
+			if(marker != NULL){
+				T_usbmidi_EVENT_PACKET batch[TX_BATCH_MAX];	//nb is limited by usbmidi_tx_events_at
+				uint16_t batch_nb = 0;
+				for(uint16_t i = 0; i < nb; i++){
+					if(tx_coalesce_packet(&packets[i], &batch[batch_nb])) batch_nb++;
+				}
+				if(batch_nb > 0){
+					marker->midi[2] = (uint8_t)batch_nb;
+					xQueueSend(midi_out_queue, marker, 0);
+				}
+				for(uint16_t i = 0; i < batch_nb; i++){
+					xQueueSend(midi_out_queue, &batch[i], 0);
+				}
+			}
+			else{
+				for(uint16_t i = 0; i < nb; i++){
+					if(tx_coalesce_packet(&packets[i], &out)) xQueueSend(midi_out_queue, &out, 0);
+				}
+			}
+			if(lat_state == LAT_RXED) lat_state = LAT_QUEUED;
+			xTaskResumeAll();
+			tx_wake();
+			return 0;
+		}
+		xTaskResumeAll();
+		if(waited >= API_TX_TIMEOUT){
+			USBH_ErrLog("usbmidi_ifc: no room for %d packets in midi_out_queue",nb);
+			return -1;
+		}
+		vTaskDelay(1);
+		waited++;
+	}
+}
+int usbmidi_tx_events(T_usbmidi_EVENT_PACKET* packets, uint16_t nb){
+	return tx_enqueue(NULL, packets, nb);
+}
+int usbmidi_tx_events_at(T_usbmidi_EVENT_PACKET* packets, uint16_t nb, uint32_t frame){
+	T_usbmidi_EVENT_PACKET marker;
+	if(nb == 0) return 0;
+	if(nb > TX_BATCH_MAX){
+		USBH_ErrLog("usbmidi_tx_events_at: %d packets won't fit in one transfer",nb);
+		return -1;
+	}
+	marker.cn_cin = TX_MARKER_CN_CIN;
+	marker.midi[0] = (uint8_t)(frame >> 8);
+	marker.midi[1] = (uint8_t)frame;
+	marker.midi[2] = (uint8_t)nb;
+	return tx_enqueue(&marker, packets, nb);
+}
+uint32_t usbmidi_frame_now(void){
+	return USBH_MIDI_GetFrame(phost);
+}
+
+/*
+ * fills a CC event packet, doesn't send anything
+ * channel is 1..16, as in usbmidi_tx_cc
+ * returns 0 on success, -1 if any of the arguments is out of range
+ */
+int usbmidi_pack_cc(T_usbmidi_EVENT_PACKET* packet, uint8_t ch, uint8_t ctrl, uint8_t value){
+	if(ch > 16) return -1;
+	if(ch == 0) return -1;
+	if(ctrl > 0x7F) return -1;
+	if(value > 0x7F) return -1;
+	packet->cn_cin = cable | CIN_CC;
+	packet->midi[0] = MIDI_STATUS_CONTROL_CHANGE | (ch - 1);
+	packet->midi[1] = ctrl;
+	packet->midi[2] = value;
 	return 0;
 }
 
@@ -335,15 +1024,27 @@ int usbmidi_tx_message(uint8_t status, uint8_t data1, uint8_t data2){
 }
 
 int usbmidi_inject_to_midi_in(T_usbmidi_EVENT_PACKET* packet, uint16_t len){
-	for(uint16_t packet_idx = 0; packet_idx < len; packet_idx++){
+	uint16_t packet_idx = 0;
+	while(packet_idx < len){
+		rx_frame_t* frame;
+		if(xQueueReceive(rx_free_queue, &frame, 100) != pdPASS){
+			USBH_ErrLog("usbmidi_inject_to_midi_in: no free rx frame.\n");
+			return -1;
+		}
+		uint16_t frame_len = 0;
+		while( (packet_idx < len) && (frame_len < RX_BUFF_SIZE) ){
 #if TESTING
-		T_usbmidi_EVENT_PACKET* pPacket = &packet[packet_idx];
-		xprintf("usbmidi_inject_to_midi_in, proc pkt idx=%d: ",packet_idx);
+			T_usbmidi_EVENT_PACKET* pPacket = &packet[packet_idx];
+			xprintf("usbmidi_inject_to_midi_in, proc pkt idx=%d: ",packet_idx);
 			debug_hexbuf(pPacket, 4);
 #endif
-			if(xQueueSend(midi_in_queue,&packet[packet_idx],100) != pdPASS){
-			USBH_ErrLog("usbmidi_inject_to_midi_in: could not send a packet to midi_in_queue.\n");
+			memcpy(&frame->data[frame_len], &packet[packet_idx], EVENT_PACKET_SIZE);
+			frame_len += EVENT_PACKET_SIZE;
+			packet_idx++;
 		}
+		frame->len = frame_len;
+		frame->stamp = usbmidi_cb_timestamp();
+		xQueueSend(rx_ready_queue, &frame, 0);
 	}
 	return 0;
 }
@@ -388,7 +1089,10 @@ void usbmidi_tx_cc(uint8_t ch, uint8_t ctrl, uint8_t value){			//control change
 	usbmidi_tx_message(MIDI_STATUS_CONTROL_CHANGE | ch, ctrl, value);
 }
 
-
+/*
+ * SysEx goes to the bulk lane, behind the realtime and performance messages
+ * (a long one waits for the lane to drain, API_TX_TIMEOUT for each packet)
+ */
 void usbmidi_tx_sysex(uint8_t* buf, uint16_t len){
 	int i = 0;
 	while(i<len){
@@ -427,20 +1131,234 @@ void usbmidi_tx_sysex(uint8_t* buf, uint16_t len){
 
 
 
+void usbmidi_rx_get_stats(usbmidi_rx_stats_t* stats){
+	taskENTER_CRITICAL();
+	*stats = rx_stats;
+	taskEXIT_CRITICAL();
+}
+
+void usbmidi_rx_print_stats(void){
+	usbmidi_rx_stats_t stats;
+	uint32_t usb_frames, back_to_back;
+	usbmidi_rx_get_stats(&stats);
+	USBH_MIDI_GetRxCounters(phost, &usb_frames, &back_to_back);
+	xprintf("usbmidi rx: frames=%u packets=%u overflows=%u, free frames=%u, max wait for rx_task=%uus\n",
+			(unsigned int)stats.frames,(unsigned int)stats.packets,(unsigned int)stats.overflows,
+			(unsigned int)uxQueueMessagesWaiting(rx_free_queue),(unsigned int)stats.wait_max_us);
+	xprintf("usbmidi rx: usb frames=%u back-to-back=%u\n",(unsigned int)usb_frames,(unsigned int)back_to_back);
+	xprintf("usbmidi rx filter: filtered=%u forwarded=%u%s\n",(unsigned int)stats.filtered,(unsigned int)stats.forwarded,
+			(rx_filter == &rx_filter_all) ? " (off)" : (rx_filter_open ? " (open after a PC)" : ""));
+}
+
+/*
+ * rx dispatch benchmark: runs a mix of packets (notes, CC, PC, pitch bend, clock, a SysEx
+ * in three packets) through rx_packet with 1 and then RX_SUBS_MAX no-op handlers
+ * subscribed to every class, and prints the cycles per packet
+ * the subscribers are swapped out for the time of the run, with rx_lock taken and the scheduler
+ * suspended, so nothing reaches the real handlers; the interrupts still run, so max includes them
+ * the rx filter isn't touched, it's rx_packet that's measured
+ */
+static volatile uint32_t bench_calls;
+static void bench_handler(const uint8_t* msg, uint16_t len, void* ctx){
+	bench_calls++;
+}
+
+void usbmidi_rx_dispatch_bench(void){
+	static const T_usbmidi_EVENT_PACKET mix[] = {
+		{CIN_NOTE_ON,		{0x90, 0x24, 0x64}},
+		{CIN_CC,			{0xB1, 0x50, 0x6E}},
+		{CIN_SINGLE_BYTE,	{0xF8, 0x00, 0x00}},
+		{CIN_NOTE_OFF,		{0x80, 0x24, 0x40}},
+		{CIN_PITCH_BEND,	{0xE0, 0x00, 0x40}},
+		{CIN_PC,			{0xC0, 0x05, 0x00}},
+		{CIN_SYSEX_ST_CNT,	{0xF0, 0x7E, 0x7F}},
+		{CIN_SYSEX_ST_CNT,	{0x06, 0x01, 0x00}},
+		{CIN_SYSEX_END_2B,	{0x00, 0xF7, 0x00}},
+	};
+	const int MIX_NB = sizeof(mix) / sizeof(mix[0]);
+	const int ROUNDS = 1000;
+	static rx_entry_t saved_table[16];
+	static rx_entry_t saved_sysex_subs;
+	static uint8_t saved_sysex_rx[usbmidi_SYSEX_MAX_LEN];
+	int saved_sysex_rx_idx;
+	uint32_t avg[2], max[2], calls[2];
+
+	rx_lock_take();		//rx_task must not dispatch anything in the meantime
+	vTaskSuspendAll();
+	memcpy(saved_table, rx_table, sizeof(rx_table));
+	saved_sysex_subs = rx_sysex_subs;
+	memcpy(saved_sysex_rx, sysex_rx, sizeof(sysex_rx));
+	saved_sysex_rx_idx = sysex_rx_idx;
+
+	for(int run = 0; run < 2; run++){
+		int subs_nb = run ? RX_SUBS_MAX : 1;
+		for(uint8_t cin = 0; cin < 16; cin++){
+			if( (cin < CIN_SYSEX_ST_CNT) || (cin > CIN_SYSEX_END_3B) ) rx_table[cin].nb = 0;
+		}
+		rx_sysex_subs.nb = 0;
+		for(int i = 0; i < subs_nb; i++){	//as usbmidi_rx_subscribe(USBMIDI_RX_ALL, ...), which would wait for rx_lock
+			for(uint8_t cin = 0; cin < 16; cin++){
+				if(!(USBMIDI_RX_ALL & (1 << cin))) continue;
+				rx_entry_add((cin == CIN_SYSEX_ST_CNT) ? &rx_sysex_subs : &rx_table[cin], bench_handler, (void*)(uintptr_t)i);
+			}
+		}
+		sysex_rx_idx = 0;
+		bench_calls = 0;
+		max[run] = 0;
+		uint32_t t_start = cyccnt_now();
+		for(int round = 0; round < ROUNDS; round++){
+			for(int i = 0; i < MIX_NB; i++){
+				T_usbmidi_EVENT_PACKET packet = mix[i];
+				uint32_t t0 = cyccnt_now();
+				rx_packet(&packet);
+				uint32_t t = cyccnt_now() - t0;
+				if(t > max[run]) max[run] = t;
+			}
+		}
+		avg[run] = (cyccnt_now() - t_start) / (ROUNDS * MIX_NB);
+		calls[run] = bench_calls;
+	}
+
+	memcpy(rx_table, saved_table, sizeof(rx_table));
+	rx_sysex_subs = saved_sysex_subs;
+	memcpy(sysex_rx, saved_sysex_rx, sizeof(sysex_rx));
+	sysex_rx_idx = saved_sysex_rx_idx;
+	xTaskResumeAll();
+	rx_lock_give();
+
+	for(int run = 0; run < 2; run++){
+		xprintf("rx dispatch, %d handler(s) per class: %u cycles/packet avg (loop included), %u max, %u handler calls\n",
+				run ? RX_SUBS_MAX : 1,(unsigned int)avg[run],(unsigned int)max[run],(unsigned int)calls[run]);
+	}
+}
+
+void usbmidi_tx_get_stats(usbmidi_tx_stats_t* stats){
+	taskENTER_CRITICAL();
+	*stats = tx_stats;
+	taskEXIT_CRITICAL();
+}
+
+void usbmidi_tx_reset_stats(void){
+	taskENTER_CRITICAL();
+	tx_stats.packets = 0;
+	tx_stats.transfers = 0;
+	tx_stats.done = 0;
+	tx_stats.dropped = 0;
+	tx_stats.timed = 0;
+	tx_stats.superseded = 0;
+	tx_stats.deduped = 0;
+	tx_stats.resynced = 0;
+	tx_stats.realtime = 0;
+	tx_stats.bulk = 0;
+	lat_stats.count = 0;
+	lat_stats.last_us = 0;
+	lat_stats.sum_us = 0;
+	lat_stats.max_us = 0;
+	taskEXIT_CRITICAL();
+}
+
+void usbmidi_tx_print_stats(void){
+	usbmidi_tx_stats_t stats;
+	usbmidi_lat_stats_t lat;
+	MIDI_FrameStatsTypeDef frames;
+	usbmidi_tx_get_stats(&stats);
+	usbmidi_lat_get_stats(&lat);
+	USBH_MIDI_GetTxFrameStats(phost, &frames);
+	xprintf("usbmidi tx: packets=%u transfers=%u done=%u dropped=%u, CCs superseded in the queue=%u\n",
+			(unsigned int)stats.packets,(unsigned int)stats.transfers,(unsigned int)stats.done,(unsigned int)stats.dropped,
+			(unsigned int)stats.superseded);
+	xprintf("usbmidi tx lanes: realtime=%u, bulk (SysEx)=%u, the rest is performance\n",
+			(unsigned int)stats.realtime,(unsigned int)stats.bulk);
+	xprintf("usbmidi tx: CCs skipped (same value)=%u, CCs restored after reconnection=%u\n",
+			(unsigned int)stats.deduped,(unsigned int)stats.resynced);
+	xprintf("usbmidi tx: frame-aligned=%u, submitted: on time=%u late=%u max late=%u frames, now @ frame %u\n",
+			(unsigned int)stats.timed,(unsigned int)frames.on_time,(unsigned int)frames.late,
+			(unsigned int)frames.max_late,(unsigned int)usbmidi_frame_now());
+	xprintf("usbmidi note->cc latency: n=%u last=%uus avg=%uus max=%uus (usb class throttle %s)\n",
+			(unsigned int)lat.count,(unsigned int)lat.last_us,
+			(unsigned int)(lat.count ? (lat.sum_us / lat.count) : 0),(unsigned int)lat.max_us,
+			USBH_MIDI_PROCESS_THROTTLE ? "on" : "off");
+}
+void usbmidi_lat_get_stats(usbmidi_lat_stats_t* stats){
+	taskENTER_CRITICAL();
+	stats->count = lat_stats.count;
+	stats->last_us = lat_stats.last_us;
+	stats->sum_us = lat_stats.sum_us;
+	stats->max_us = lat_stats.max_us;
+	taskEXIT_CRITICAL();
+}
+
+/*
+ * TX throughput benchmark
+ * sends packets_nb CC messages (an undefined CC on channel 16) as fast as possible
+ * with max_batch packets per transfer (1 = the old one-packet-per-transfer behaviour)
+ * and measures how long it takes until all of them are confirmed by the USB stack
+ * returns packets per second or -1 on timeout
+ */
+int usbmidi_tx_benchmark(uint16_t packets_nb, uint16_t max_batch){
+	const TickType_t BENCH_TIMEOUT = 10000;
+	T_usbmidi_EVENT_PACKET packet;
+	usbmidi_pack_cc(&packet, 16, 0x66, 0);
+
+	if(max_batch == 0) max_batch = 1;
+	if(max_batch > TX_BATCH_MAX) max_batch = TX_BATCH_MAX;
+	while(tx_pending() || tx_in_flight) vTaskDelay(1);
+	tx_max_batch = max_batch;
+	tx_coalesce = 0;	//the same CC over and over, all of them have to go out
+	usbmidi_tx_reset_stats();
+
+	TickType_t t_start = xTaskGetTickCount();
+	for(uint16_t i = 0; i < packets_nb; i++){
+		packet.midi[2] = i & 0x7F;
+		usbmidi_tx_event(&packet);
+	}
+	while( (tx_stats.done < packets_nb) && ((xTaskGetTickCount() - t_start) < BENCH_TIMEOUT) ){
+		vTaskDelay(1);
+	}
+	TickType_t t_ms = xTaskGetTickCount() - t_start;
+	tx_max_batch = TX_BATCH_MAX;
+	tx_coalesce = 1;
+
+	if(tx_stats.done < packets_nb){
+		xprintf("usbmidi_tx_benchmark: timeout, %u of %u packets sent\n",(unsigned int)tx_stats.done,(unsigned int)packets_nb);
+		return -1;
+	}
+	if(t_ms == 0) t_ms = 1;
+	int pps = (int)((packets_nb * 1000UL) / t_ms);
+	xprintf("usbmidi_tx_benchmark: batch=%u: %u packets in %u transfers, %ums, %d packets/s\n",
+			(unsigned int)max_batch,(unsigned int)packets_nb,(unsigned int)tx_stats.transfers,(unsigned int)t_ms,pps);
+	return pps;
+}
+
 int usbmidi_init(void){
 	midi_out_queue = xQueueCreate(MIDI_QUEUE_LEN, sizeof(T_usbmidi_EVENT_PACKET));
-	midi_in_queue  = xQueueCreate(MIDI_QUEUE_LEN, sizeof(T_usbmidi_EVENT_PACKET));
+	tx_rt_queue = xQueueCreate(TX_RT_QUEUE_LEN, sizeof(T_usbmidi_EVENT_PACKET));
+	tx_bulk_queue = xQueueCreate(TX_BULK_QUEUE_LEN, sizeof(T_usbmidi_EVENT_PACKET));
+	rx_free_queue  = xQueueCreate(RX_FRAMES_NB, sizeof(rx_frame_t*));
+	rx_ready_queue = xQueueCreate(RX_FRAMES_NB, sizeof(rx_frame_t*));
 	tx_busy = xSemaphoreCreateBinary();
+	rx_lock = xSemaphoreCreateMutex();
+	memset(cc_shadow, CC_SHADOW_NONE, sizeof(cc_shadow));
+	for(uint8_t cin = CIN_SYSEX_ST_CNT; cin <= CIN_SYSEX_END_3B; cin++){
+		rx_entry_add(&rx_table[cin], rx_sysex_collect, (void*)(uintptr_t)cin);
+	}
 	BaseType_t res;
 	//res = xTaskCreate(usbmidi_core_task, "mcore", configMINIMAL_STACK_SIZE + 512, NULL, osPriorityAboveNormal, NULL);
 	//if(res != pdPASS) {USBH_ErrLog("usbmidi_core_task not created\n"); return -1;}
 	res = xTaskCreate(rx_task, "rx", configMINIMAL_STACK_SIZE + 128, NULL, osPriorityNormal, NULL);
 	if(res != pdPASS) {USBH_ErrLog("rx_task not created\n"); return -1;}
-	res = xTaskCreate(tx_task, "tx", configMINIMAL_STACK_SIZE + 128, NULL, osPriorityNormal, NULL);
+	res = xTaskCreate(tx_task, "tx", configMINIMAL_STACK_SIZE + 128, NULL, osPriorityNormal, &tx_task_handle);
 	if(res != pdPASS) {USBH_ErrLog("tx_task not created\n"); return -1;}
 
 	if(midi_out_queue == NULL) {USBH_ErrLog("midi_out_queue not created\n"); return -1;}
-	if(midi_in_queue == NULL) {USBH_ErrLog("midi_in_queue not created\n"); return -1;}
+	if(tx_rt_queue == NULL) {USBH_ErrLog("tx_rt_queue not created\n"); return -1;}
+	if(tx_bulk_queue == NULL) {USBH_ErrLog("tx_bulk_queue not created\n"); return -1;}
+	if(rx_free_queue == NULL) {USBH_ErrLog("rx_free_queue not created\n"); return -1;}
+	if(rx_ready_queue == NULL) {USBH_ErrLog("rx_ready_queue not created\n"); return -1;}
+	for(int i = 0; i < RX_FRAMES_NB; i++){
+		rx_frame_t* frame = &rx_frames[i];
+		xQueueSend(rx_free_queue, &frame, 0);
+	}
 	if(tx_busy == NULL) {USBH_ErrLog("tx_busy semaphore not created\n"); return -1;}
 
 	xprintf("usbmidi_init OK\n");
@@ -456,45 +1374,48 @@ void usbmidi_set_cable(uint8_t p_cable){
 void usbmidi_start(void){
 	xprintf("usbmidi_start...\n");
 	vTaskDelay(1000);
-	USBH_MIDI_Receive(phost, MIDI_RX_Buffer, RX_BUFF_SIZE); //initiate the rx of the first packet
+	//prime both halves of the ping-pong: the second one is armed as soon as the first completes
+	xQueueReceive(rx_free_queue, &rx_armed[0], 0);
+	xQueueReceive(rx_free_queue, &rx_armed[1], 0);
+	USBH_MIDI_Receive(phost, rx_armed[0]->data, RX_BUFF_SIZE); //initiate the rx of the first packet
+	USBH_MIDI_ReceiveNext(phost, rx_armed[1]->data, RX_BUFF_SIZE);
 	xSemaphoreGive(tx_busy);
+	started = 1;
 	xprintf("usbmidi_start exit\n");
 }
 
-__weak void usbmidi_cb_byte(uint8_t b){
-	WEAK_CB_PRINT("WEAK Callback: usbmidi_cb_byte, b=%X\n",b);
-}
-
-__weak void usbmidi_cb_note_on(uint8_t ch, uint8_t note, uint8_t velocity){
-	WEAK_CB_PRINT("WEAK Callback: usbmidi_note_on_cb, ch=%X, note=%02X, velo=%02X\n",ch,note,velocity);
-}
-
-__weak void usbmidi_cb_note_off(uint8_t ch, uint8_t note, uint8_t velocity){
-	WEAK_CB_PRINT("WEAK Callback: usbmidi_note_off_cb, ch=%X, note=%02X, velo=%02X\n",ch,note,velocity);
-}
-
-__weak void usbmidi_cb_pitchbend(uint8_t ch, uint8_t data1, uint8_t data2){
-	WEAK_CB_PRINT("WEAK Callback: usbmidi_pitchbend_cb, ch=%X, data1=%02X, data2=%02X\n",ch,data1,data2);
-}
-
-__weak void usbmidi_cb_aftertouch(uint8_t ch, uint8_t data1, uint8_t data2){
-	WEAK_CB_PRINT("WEAK Callback: usbmidi_cb_aftertouch, ch=%X, data1=%02X, data2=%02X\n",ch,data1,data2);
-}
-
-__weak void usbmidi_cb_syscomm(uint8_t status, uint8_t data1, uint8_t data2){	//raw format, channel is encoded in status
-	WEAK_CB_PRINT("WEAK Callback: usbmidi_syscomm_cb, status=%X, data1=%02X, data2=%02X\n",status,data1,data2);
-}
-
-__weak void usbmidi_cb_pc(uint8_t ch, uint8_t program){						//program change
-	WEAK_CB_PRINT("WEAK Callback: usbmidi_pc_cb, ch=%X, program=%02X\n",ch,program);
+/*
+ * to be called on HOST_USER_CLASS_ACTIVE (from the USB host thread, so it doesn't block)
+ * after a reconnection the class handle is a new one: the reception is armed again
+ * with the same two frames, the transfer which was in flight when the device
+ * went away is forgotten, and tx_task is asked to restore all the CCs from cc_shadow
+ * before the first connection usbmidi_start() does the priming, there's nothing to restore
+ */
+void usbmidi_class_active(void){
+	T_usbmidi_EVENT_PACKET resync = {TX_RESYNC_CN_CIN, {0, 0, 0}};
+	if(!started) return;
+	USBH_MIDI_Receive(phost, rx_armed[0]->data, RX_BUFF_SIZE);
+	USBH_MIDI_ReceiveNext(phost, rx_armed[1]->data, RX_BUFF_SIZE);
+	tx_in_flight = 0;
+	xSemaphoreGive(tx_busy);
+	if(xQueueSend(midi_out_queue, &resync, 0) != pdTRUE){
+		USBH_ErrLog("usbmidi_class_active: no room for the resync request");
+	}
+	tx_wake();
 }
 
-__weak void usbmidi_cb_cc(uint8_t ch, uint8_t ctrl, uint8_t value){			//control change rxed
-	WEAK_CB_PRINT("WEAK Callback: usbmidi_cc_cb");
+/*
+ * arrival time of the packet being handled - valid inside the rx handlers (see usbmidi_rx_subscribe)
+ * all the packets of one USB frame share the same timestamp
+ */
+uint32_t usbmidi_rx_timestamp(void){
+	return rx_stamp;
 }
 
-__weak void usbmidi_cb_sysex(uint8_t* buf, uint16_t len){						//buf contains raw data, including the 0xF0 & 0xF7
-	WEAK_CB_PRINT("WEAK Callback: usbmidi_sysex_cb, len=%02X\n",len);
+/*
+ * the timebase for the rx timestamps and the latency measurements [us]
+ * override it with a finer one, the default has the RTOS tick resolution
+ */
+__weak uint32_t usbmidi_cb_timestamp(void){
+	return xTaskGetTickCount() * portTICK_PERIOD_MS * 1000;
 }
-
-
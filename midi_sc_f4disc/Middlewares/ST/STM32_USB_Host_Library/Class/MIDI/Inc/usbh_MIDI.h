@@ -14,6 +14,18 @@
 
 extern USBH_ClassTypeDef  MIDI_Class;
 
+/*
+ * the original class slept for 1 ms on every pass of USBH_MIDI_Process,
+ * which added one or more milliseconds to every transfer
+ * now the class only runs when there's something to do: on the URB change
+ * notifications (USBH_LL_NotifyURBChange) and on the explicit requests
+ * (transmit / receive); set this to 1 to get the old behaviour back,
+ * e.g. for before/after latency measurements
+ */
+#ifndef USBH_MIDI_PROCESS_THROTTLE
+#define USBH_MIDI_PROCESS_THROTTLE  0
+#endif
+
 typedef enum
 {
   MIDI_IDLE= 0,
@@ -21,9 +33,20 @@ typedef enum
   MIDI_SEND_DATA_WAIT,
   MIDI_RECEIVE_DATA,
   MIDI_RECEIVE_DATA_WAIT,
+  MIDI_SEND_DATA_SCHEDULED,     /* waiting for the SOF of TxDueFrame, holds the OUT pipe */
+  MIDI_SEND_DATA_DUE,           /* released by the SOF handler, the host thread submits it */
 }
 MIDI_DataStateTypeDef;
 
+typedef struct
+{
+  uint32_t    scheduled;        /* transfers released by the SOF handler */
+  uint32_t    on_time;          /* ...and submitted within their due frame */
+  uint32_t    late;             /* ...in a later frame */
+  uint32_t    max_late;         /* the worst lateness, in frames */
+}
+MIDI_FrameStatsTypeDef;
+
 typedef enum
 {
   MIDI_IDLE_STATE= 0,
@@ -46,6 +69,14 @@ typedef struct _MIDI_Process
   uint8_t     *pRxData;
   uint16_t    TxDataLength;
   uint16_t    RxDataLength;
+  uint8_t     *pRxNext;         /* double-buffered rx: armed as soon as pRxData is complete */
+  uint16_t    RxNextLength;
+  uint8_t     *pRxLast;         /* the most recently completed rx buffer */
+  uint16_t    RxLastLength;
+  uint32_t    RxFrames;
+  uint32_t    RxBackToBack;     /* frames after which the next rx was queued without a gap */
+  uint32_t    TxDueFrame;       /* frame number (phost->Timer) for a scheduled transmission */
+  MIDI_FrameStatsTypeDef  TxFrameStats;
   MIDI_DataStateTypeDef   data_tx_state;
   MIDI_DataStateTypeDef   data_rx_state;
   uint8_t           Rx_Poll;
@@ -58,13 +89,32 @@ USBH_StatusTypeDef  USBH_MIDI_Transmit(USBH_HandleTypeDef *phost,
                                       uint8_t *pbuff,
                                       uint16_t length);
 
+USBH_StatusTypeDef  USBH_MIDI_TransmitAtFrame(USBH_HandleTypeDef *phost,
+                                             uint8_t *pbuff,
+                                             uint16_t length,
+                                             uint32_t frame);
+
+uint32_t            USBH_MIDI_GetFrame(USBH_HandleTypeDef *phost);
+
+void                USBH_MIDI_GetTxFrameStats(USBH_HandleTypeDef *phost, MIDI_FrameStatsTypeDef *stats);
+
 USBH_StatusTypeDef  USBH_MIDI_Receive(USBH_HandleTypeDef *phost,
                                      uint8_t *pbuff,
                                      uint16_t length);
 
+USBH_StatusTypeDef  USBH_MIDI_ReceiveNext(USBH_HandleTypeDef *phost,
+                                         uint8_t *pbuff,
+                                         uint16_t length);
+
+uint8_t*            USBH_MIDI_GetLastReceivedData(USBH_HandleTypeDef *phost);
+
+void                USBH_MIDI_GetRxCounters(USBH_HandleTypeDef *phost, uint32_t *frames, uint32_t *back_to_back);
+
 
 uint16_t            USBH_MIDI_GetLastReceivedDataSize(USBH_HandleTypeDef *phost);
 
+uint16_t            USBH_MIDI_GetMaxTxSize(USBH_HandleTypeDef *phost);
+
 USBH_StatusTypeDef  USBH_MIDI_Stop(USBH_HandleTypeDef *phost);
 
 void USBH_MIDI_TransmitCallback(USBH_HandleTypeDef *phost);
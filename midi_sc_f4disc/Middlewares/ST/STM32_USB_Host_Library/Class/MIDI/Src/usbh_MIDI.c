@@ -55,6 +55,7 @@ static USBH_StatusTypeDef USBH_MIDI_SOFProcess(USBH_HandleTypeDef *phost);
 static USBH_StatusTypeDef USBH_MIDI_ClassRequest (USBH_HandleTypeDef *phost);
 static void MIDI_ProcessTransmission(USBH_HandleTypeDef *phost);
 static void MIDI_ProcessReception(USBH_HandleTypeDef *phost);
+static void MIDI_SendChunk(USBH_HandleTypeDef *phost);
 
 USBH_ClassTypeDef  MIDI_Class =
 {
@@ -363,7 +364,9 @@ static USBH_StatusTypeDef USBH_MIDI_Process (USBH_HandleTypeDef *phost)
   USBH_StatusTypeDef req_status = USBH_OK;
   MIDI_HandleTypeDef *MIDI_Handle =  phost->pActiveClass->pData;
 
+#if USBH_MIDI_PROCESS_THROTTLE
   vTaskDelay(1);
+#endif
 
   switch(MIDI_Handle->state)
   {
@@ -399,11 +402,29 @@ static USBH_StatusTypeDef USBH_MIDI_Process (USBH_HandleTypeDef *phost)
 /**
   * @brief  USBH_MIDI_SOFProcess 
   *         The function is for managing SOF callback 
+  *         Releases the transmission scheduled with USBH_MIDI_TransmitAtFrame
+  *         at the beginning of its frame. Called from the HCD interrupt, so it
+  *         only compares the frame number: the host library isn't reentrant,
+  *         the transfer itself is submitted by the host thread (MIDI_ProcessTransmission),
+  *         like every other one
   * @param  phost: Host handle
   * @retval USBH Status
   */
 static USBH_StatusTypeDef USBH_MIDI_SOFProcess (USBH_HandleTypeDef *phost)
 {
+  MIDI_HandleTypeDef *MIDI_Handle =  phost->pActiveClass->pData;
+
+  if((MIDI_Handle != NULL) && (MIDI_Handle->data_tx_state == MIDI_SEND_DATA_SCHEDULED))
+  {
+    if((int32_t)(phost->Timer - MIDI_Handle->TxDueFrame) >= 0)
+    {
+      /* the host thread doesn't touch data_tx_state while it's scheduled */
+      MIDI_Handle->data_tx_state = MIDI_SEND_DATA_DUE;
+#if (USBH_USE_OS == 1U)
+      USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
+    }
+  }
   return USBH_OK;  
 }
   
@@ -420,7 +441,71 @@ uint16_t USBH_MIDI_GetLastReceivedDataSize(USBH_HandleTypeDef *phost)
 
   if(phost->gState == HOST_CLASS)
   {
-    return USBH_LL_GetLastXferSize(phost, MIDI_Handle->InPipe);
+    return MIDI_Handle->RxLastLength;
+  }
+  else
+  {
+    return 0;
+  }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------------*/
+
+/**
+ * @brief  This function returns the buffer of the most recently completed reception
+ *         (with double buffering it's no longer the buffer the class is receiving into)
+ * @param  phost: Host handle
+ * @retval pointer to the received data or NULL
+ */
+uint8_t* USBH_MIDI_GetLastReceivedData(USBH_HandleTypeDef *phost)
+{
+  MIDI_HandleTypeDef *MIDI_Handle =  phost->pActiveClass->pData;
+
+  if(phost->gState == HOST_CLASS)
+  {
+    return MIDI_Handle->pRxLast;
+  }
+  else
+  {
+    return NULL;
+  }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------------*/
+
+/**
+ * @brief  This function returns the reception counters
+ * @param  phost: Host handle
+ * @param  frames: all the completed receptions
+ * @param  back_to_back: receptions after which the next one was started in the same step
+ * @retval None
+ */
+void USBH_MIDI_GetRxCounters(USBH_HandleTypeDef *phost, uint32_t *frames, uint32_t *back_to_back)
+{
+  *frames = 0;
+  *back_to_back = 0;
+  if((phost->gState == HOST_CLASS) && (phost->pActiveClass != NULL) && (phost->pActiveClass->pData != NULL))
+  {
+    MIDI_HandleTypeDef *MIDI_Handle =  phost->pActiveClass->pData;
+    *frames = MIDI_Handle->RxFrames;
+    *back_to_back = MIDI_Handle->RxBackToBack;
+  }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------------*/
+
+/**
+ * @brief  This function returns the max number of bytes sent in a single bulk OUT packet
+ *         (the OUT endpoint size), so that the caller can aggregate its data
+ * @param  phost: Host handle
+ * @retval OUT endpoint size or 0 if the class is not active
+ */
+uint16_t USBH_MIDI_GetMaxTxSize(USBH_HandleTypeDef *phost)
+{
+  if((phost->gState == HOST_CLASS) && (phost->pActiveClass != NULL) && (phost->pActiveClass->pData != NULL))
+  {
+    MIDI_HandleTypeDef *MIDI_Handle =  phost->pActiveClass->pData;
+    return MIDI_Handle->OutEpSize;
   }
   else
   {
@@ -459,6 +544,71 @@ USBH_StatusTypeDef  USBH_MIDI_Transmit(USBH_HandleTypeDef *phost, uint8_t *pbuff
 
 /*------------------------------------------------------------------------------------------------------------------------------*/
 
+/**
+ * @brief  Frame-aligned transmission (added by Ada Locriana)
+ *         Like USBH_MIDI_Transmit, but the first bulk OUT packet waits for the SOF
+ *         of the given frame: the SOF handler releases it and the host thread submits
+ *         it right away, so the data goes out on a frame boundary (plus the switch
+ *         to the host thread). A frame that has already passed is released at the next
+ *         SOF (counted as late if it's not submitted within the due frame).
+ *         The transfer holds the OUT pipe from this call until its target frame:
+ *         nothing else can be sent in the meantime, so the frame should be near.
+ * @param  phost: Host handle
+ * @param  pbuff: data (must stay valid until USBH_MIDI_TransmitCallback)
+ * @param  length: data length
+ * @param  frame: target frame number, see USBH_MIDI_GetFrame
+ * @retval USBH Status
+ */
+USBH_StatusTypeDef  USBH_MIDI_TransmitAtFrame(USBH_HandleTypeDef *phost, uint8_t *pbuff, uint16_t length, uint32_t frame)
+{
+  USBH_StatusTypeDef Status = USBH_BUSY;
+  MIDI_HandleTypeDef *MIDI_Handle =  phost->pActiveClass->pData;
+
+  if((MIDI_Handle->state == MIDI_IDLE_STATE) || (MIDI_Handle->state == MIDI_TRANSFER_DATA))
+  {
+    MIDI_Handle->pTxData = pbuff;
+    MIDI_Handle->TxDataLength = length;
+    MIDI_Handle->TxDueFrame = frame;
+    MIDI_Handle->state = MIDI_TRANSFER_DATA;
+    __DMB();    /* all the above must be visible to the SOF interrupt before it's armed */
+    MIDI_Handle->data_tx_state = MIDI_SEND_DATA_SCHEDULED;   /* armed, the SOF handler releases it */
+    Status = USBH_OK;
+  }
+  return Status;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------------*/
+
+/**
+ * @brief  This function returns the current frame number (SOFs counted by the host)
+ * @param  phost: Host handle
+ * @retval frame number
+ */
+uint32_t USBH_MIDI_GetFrame(USBH_HandleTypeDef *phost)
+{
+  return phost->Timer;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------------*/
+
+/**
+ * @brief  This function returns the statistics of the frame-aligned transmissions
+ * @param  phost: Host handle
+ * @param  stats: output
+ * @retval None
+ */
+void USBH_MIDI_GetTxFrameStats(USBH_HandleTypeDef *phost, MIDI_FrameStatsTypeDef *stats)
+{
+  USBH_memset(stats, 0, sizeof(MIDI_FrameStatsTypeDef));
+  if((phost->gState == HOST_CLASS) && (phost->pActiveClass != NULL) && (phost->pActiveClass->pData != NULL))
+  {
+    MIDI_HandleTypeDef *MIDI_Handle =  phost->pActiveClass->pData;
+    *stats = MIDI_Handle->TxFrameStats;
+  }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------------*/
+
 /**
  * @brief  This function prepares the state before issuing the class specific commands
  * @param  None
@@ -486,6 +636,68 @@ USBH_StatusTypeDef  USBH_MIDI_Receive(USBH_HandleTypeDef *phost, uint8_t *pbuff,
 
 /*------------------------------------------------------------------------------------------------------------------------------*/
 
+/**
+ * @brief  Double-buffered reception (added by Ada Locriana)
+ *         Queues the buffer for the reception following the current one.
+ *         When the current reception completes, the next bulk IN transfer
+ *         is started on this buffer right away (in the same process step),
+ *         before USBH_MIDI_ReceiveCallback is called, so there's no gap
+ *         in IN polling. Call it from USBH_MIDI_ReceiveCallback to keep
+ *         the ping-pong going.
+ *         If there's no reception in progress, it works like USBH_MIDI_Receive.
+ * @param  phost: Host handle
+ * @param  pbuff: buffer for the next reception
+ * @param  length: buffer length
+ * @retval USBH Status
+ */
+USBH_StatusTypeDef  USBH_MIDI_ReceiveNext(USBH_HandleTypeDef *phost, uint8_t *pbuff, uint16_t length)
+{
+  MIDI_HandleTypeDef *MIDI_Handle =  phost->pActiveClass->pData;
+
+  if((MIDI_Handle->state == MIDI_TRANSFER_DATA) &&
+     ((MIDI_Handle->data_rx_state == MIDI_RECEIVE_DATA) || (MIDI_Handle->data_rx_state == MIDI_RECEIVE_DATA_WAIT)))
+  {
+    MIDI_Handle->pRxNext = pbuff;
+    MIDI_Handle->RxNextLength = length;
+    return USBH_OK;
+  }
+  return USBH_MIDI_Receive(phost, pbuff, length);
+}
+
+/*------------------------------------------------------------------------------------------------------------------------------*/
+
+/**
+ * @brief  Submits the next bulk OUT packet of the current transmission
+ *         (used by the state machine only, in the host thread)
+ * @param  phost: Host handle
+ * @retval None
+ */
+static void MIDI_SendChunk(USBH_HandleTypeDef *phost)
+{
+  MIDI_HandleTypeDef *MIDI_Handle =  phost->pActiveClass->pData;
+
+  if(MIDI_Handle->TxDataLength > MIDI_Handle->OutEpSize)
+  {
+    USBH_BulkSendData (phost,
+        MIDI_Handle->pTxData,
+        MIDI_Handle->OutEpSize,
+        MIDI_Handle->OutPipe,
+        1U);
+  }
+  else
+  {
+    USBH_BulkSendData (phost,
+        MIDI_Handle->pTxData,
+        (uint16_t)MIDI_Handle->TxDataLength,
+        MIDI_Handle->OutPipe,
+        1U);
+  }
+
+  MIDI_Handle->data_tx_state = MIDI_SEND_DATA_WAIT;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------------*/
+
 /**
  * @brief  The function is responsible for sending data to the device
  *  @param  pdev: Selected device
@@ -495,31 +707,33 @@ static void MIDI_ProcessTransmission(USBH_HandleTypeDef *phost)
 {
   MIDI_HandleTypeDef *MIDI_Handle =  phost->pActiveClass->pData;
   USBH_URBStateTypeDef URB_Status = USBH_URB_IDLE;
+  int32_t late;
 
   switch(MIDI_Handle->data_tx_state)
   {
 
   case MIDI_SEND_DATA:
     //USBH_DbgLog("MIDI_ProcessTransmission, MIDI_SEND_DATA");
+    MIDI_SendChunk(phost);
+    break;
 
-    if(MIDI_Handle->TxDataLength > MIDI_Handle->OutEpSize)
+  case MIDI_SEND_DATA_DUE:
+    /* released by the SOF handler, the lateness is counted when it's actually submitted */
+    late = (int32_t)(phost->Timer - MIDI_Handle->TxDueFrame);
+    MIDI_SendChunk(phost);
+    MIDI_Handle->TxFrameStats.scheduled++;
+    if(late <= 0)
     {
-      USBH_BulkSendData (phost,
-          MIDI_Handle->pTxData,
-          MIDI_Handle->OutEpSize,
-          MIDI_Handle->OutPipe,
-          1U);
+      MIDI_Handle->TxFrameStats.on_time++;
     }
     else
     {
-      USBH_BulkSendData (phost,
-          MIDI_Handle->pTxData,
-          (uint16_t)MIDI_Handle->TxDataLength,
-          MIDI_Handle->OutPipe,
-          1U);
+      MIDI_Handle->TxFrameStats.late++;
+      if((uint32_t)late > MIDI_Handle->TxFrameStats.max_late)
+      {
+        MIDI_Handle->TxFrameStats.max_late = (uint32_t)late;
+      }
     }
-
-    MIDI_Handle->data_tx_state = MIDI_SEND_DATA_WAIT;
     break;
 
   case MIDI_SEND_DATA_WAIT:
@@ -542,6 +756,10 @@ static void MIDI_ProcessTransmission(USBH_HandleTypeDef *phost)
       if( MIDI_Handle->TxDataLength > 0)
       {
         MIDI_Handle->data_tx_state = MIDI_SEND_DATA;
+        /* the next chunk needs another pass, nothing else will wake us up */
+#if (USBH_USE_OS == 1U)
+        USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
       }
       else
       {
@@ -549,9 +767,6 @@ static void MIDI_ProcessTransmission(USBH_HandleTypeDef *phost)
         //USBH_DbgLog("calling the USBH_MIDI_TransmitCallback");
         USBH_MIDI_TransmitCallback(phost);
       }
-#if (USBH_USE_OS == 1U)
-        USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
-#endif /* (USBH_USE_OS == 1U) */
     }
     else
     {
@@ -614,16 +829,41 @@ static void MIDI_ProcessReception(USBH_HandleTypeDef *phost)
         MIDI_Handle->RxDataLength -= length ;
         MIDI_Handle->pRxData += length;
         MIDI_Handle->data_rx_state = MIDI_RECEIVE_DATA;
+#if (USBH_USE_OS == 1U)
+        USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
+#endif /* (USBH_USE_OS == 1U) */
       }
       else
       {
-        MIDI_Handle->data_rx_state = MIDI_IDLE;
+        MIDI_Handle->pRxLast = MIDI_Handle->pRxData;
+        MIDI_Handle->RxLastLength = length;
+        MIDI_Handle->RxFrames++;
+
+        if(MIDI_Handle->pRxNext != NULL)
+        {
+          /* ping-pong: keep polling IN on the other buffer before handling this one */
+          MIDI_Handle->pRxData = MIDI_Handle->pRxNext;
+          MIDI_Handle->RxDataLength = MIDI_Handle->RxNextLength;
+          MIDI_Handle->pRxNext = NULL;
+          USBH_BulkReceiveData (phost,
+              MIDI_Handle->pRxData,
+              MIDI_Handle->InEpSize,
+              MIDI_Handle->InPipe);
+#if defined (USBH_IN_NAK_PROCESS) && (USBH_IN_NAK_PROCESS == 1U)
+          phost->NakTimer = phost->Timer;
+#endif  /* defined (USBH_IN_NAK_PROCESS) && (USBH_IN_NAK_PROCESS == 1U) */
+          MIDI_Handle->data_rx_state = MIDI_RECEIVE_DATA_WAIT;
+          MIDI_Handle->RxBackToBack++;
+        }
+        else
+        {
+          MIDI_Handle->data_rx_state = MIDI_IDLE;
+        }
         //USBH_DbgLog("calling the USBH_MIDI_ReceiveCallback");
         USBH_MIDI_ReceiveCallback(phost);
+        /* the next bulk IN is already queued (or re-requested by the callback,
+           which posts its own event), its completion will notify us */
       }
-#if (USBH_USE_OS == 1U)
-        USBH_OS_PutMessage(phost, USBH_CLASS_EVENT, 0U, 0U);
-#endif /* (USBH_USE_OS == 1U) */
     }
 #if defined (USBH_IN_NAK_PROCESS) && (USBH_IN_NAK_PROCESS == 1U)
       else if (URB_Status == USBH_URB_NAK_WAIT)
@@ -26,6 +26,7 @@
 
 /* USER CODE BEGIN Includes */
 #include "usbh_MIDI.h"
+#include "usbmidi_ifc.h"
 /* USER CODE END Includes */
 
 /* USER CODE BEGIN PV */
@@ -128,6 +129,7 @@ static void USBH_UserProcess  (USBH_HandleTypeDef *phost, uint8_t id)
 
   case HOST_USER_CLASS_ACTIVE:
   Appli_state = APPLICATION_READY;
+  usbmidi_class_active();	//re-arms rx and restores the CCs after a reconnection
   break;
 
   case HOST_USER_CONNECTION: